@@ -13,7 +13,28 @@ Alexandros.Stamatakis@gmail.com
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <dirent.h>
+#include <glob.h>
+#include <pthread.h>
+#include <float.h>
+#include <limits.h>
 #include <gmp.h>
+#ifdef HAVE_MPFR
+#include <mpfr.h>
+#endif
+
+#include "treeCounter.h"
 
 #define TRUE             1
 #define FALSE            0
@@ -22,190 +43,539 @@ Alexandros.Stamatakis@gmail.com
 typedef unsigned int hashNumberType;
 
 typedef  int boolean;
-typedef  struct noderec
-{  
-  struct noderec  *next;
-  struct noderec  *back; 
-  int              number;
-  char             x;
-}
-  node, *nodeptr;
-
 
+/* 
+   hash table entries and label bytes live in two contiguous arenas, 
+   entries refer to their label via an offset into the label arena, such 
+   that interning a taxon does not require any per-taxon malloc().
+
+   The table itself uses open addressing with linear probing over a 
+   power-of-two number of slots, every slot stores the full hash value 
+   next to the entry index, such that a probe only touches the entry and 
+   label arenas when the hash values match
+*/
 
-struct stringEnt
+typedef struct
 {
   int nodeNumber;
-  char *word;
-  struct stringEnt *next;
-};
-
+  size_t wordOffset;
+  size_t length;
+}
+  stringEntry;
 
-typedef struct stringEnt stringEntry;
+typedef struct
+{
+  hashNumberType hash;
+  int entry;
+}
+  hashSlot;
 
 typedef struct
 {
   hashNumberType tableSize;
-  stringEntry **table;
+  hashNumberType entries;
+  hashNumberType entrySize;
+  hashSlot *table;
+  stringEntry *entry;
+  char *labels;
+  size_t labelsUsed;
+  size_t labelsSize;
 }
   stringHashtable;
 
+/* 
+   input backend of the Newick parser: regular files are memory mapped and 
+   tokenized straight from the mapping, pipes are read into a window that 
+   is refilled with read(). Labels are returned as views into the buffer, 
+   hence in the read() case the window is only shifted up to the start of 
+   the label that is currently being viewed (mark). A buffer of the caller 
+   of the library is borrowed and treated like a mapping. The parser writes 
+   its error messages to messages.
+*/
+
+typedef struct
+{
+  char    *buffer;
+  size_t   length;
+  size_t   position;
+  size_t   size;
+  size_t   mark;
+  char    *scratch;
+  size_t   scratchSize;
+  int      fd;
+  boolean  mapped;
+  boolean  marked;
+  boolean  borrowed;
+  boolean  ownsFd;
+  FILE    *messages;
+}
+  treeReader;
+
+/* 
+   compact topology of a constraint tree as struct of arrays with 32-bit 
+   node indices, the nodes are numbered in pre-order, i.e., node 0 is the 
+   root. Children are linked via firstChild and sibling in input order, 
+   taxon holds the taxon number of a tip and 0 for inner nodes.
+*/
+
+#define NO_NODE ((uint32_t)-1)
+
+typedef struct
+{
+  uint32_t        *parent;
+  uint32_t        *firstChild;
+  uint32_t        *sibling;
+  uint32_t        *taxon;
+  uint32_t         nodes;
+  uint32_t         size;
+}
+  topology;
+
+/* 
+   one open inner node of the tree that is currently being read, replaces 
+   the activation record of the former recursive addElementLenMULT()
+*/
+
+typedef struct
+{
+  uint32_t         node;
+  uint32_t         lastChild;
+}
+  parseFrame;
+
 typedef  struct  {
  
   stringHashtable  *nameHash; 
-  node           **nodep;
-  node            *start;
+  topology         topo;
+  parseFrame      *frames;
+  int              frameSize;
+  struct degreeHistogram *histogram;
+  struct topologySet *topologies;
+  uint32_t        *scanIndex;
+  int             *childCount;
+  int              childCountSize;
   int              mxtips;  
   int              ntips;
-  int              detectedTips;
-  int              nextnode;
  
   boolean          rooted;
   boolean          parseTree;
- 
-  char **nameList;   
+  boolean          countOnly;
+
+  int              threads;
+  boolean          useCache;
+  int              cacheTaxa;
+  boolean          approximate;
+  long long        numTaxa;
+  int              format;
+  boolean          factored;
+  boolean          expand;
+  long long        rangeFrom;
+  long long        rangeStride;
+  boolean          batch;
+  boolean          unique;
+  long long        treeIndex;
+  const char      *fileName;
+  FILE            *rowFile;
+  FILE            *messageFile;
+  int              status;
+  char           **fileNames;
+  int              fileCount;
+  int              fileSize;
+  boolean          multiFile;
+  boolean          server;
 } tree;
 
 
-#define nmlngth        256
+#define READER_BUFFER_SIZE (1 << 20)
 
 
 static boolean whitechar (int ch);
-static int treeFinishCom (FILE *fp, char **strp);
-static void  treeEchoContext (FILE *fp1, FILE *fp2, int n);
+static int treeFinishCom (treeReader *rd, char **strp);
+static void  treeEchoContext (treeReader *rd, FILE *fp2, int n);
 
 static stringHashtable *initStringHashTable(hashNumberType n)
 {
-  /* 
-     init with primes 
-  */
-    
-  static const hashNumberType initTable[] = {53, 97, 193, 389, 769, 1543, 3079, 6151, 12289, 24593, 49157, 98317,
-					     196613, 393241, 786433, 1572869, 3145739, 6291469, 12582917, 25165843,
-					     50331653, 100663319, 201326611, 402653189, 805306457, 1610612741};
- 
-
-  /* init with powers of two
-
-  static const  hashNumberType initTable[] = {64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384,
-					      32768, 65536, 131072, 262144, 524288, 1048576, 2097152,
-					      4194304, 8388608, 16777216, 33554432, 67108864, 134217728,
-					      268435456, 536870912, 1073741824, 2147483648U};
-  */
-  
   stringHashtable *h = (stringHashtable*)malloc(sizeof(stringHashtable));
-  
+
   hashNumberType
-    tableSize,
     i,
-    primeTableLength = sizeof(initTable)/sizeof(initTable[0]),
-    maxSize = (hashNumberType)-1;    
-
+    maxSize = ((hashNumberType)-1) / 4;
+  
   assert(n <= maxSize);
 
-  i = 0;
+  /* power of two with a load factor of at most 1/2 for n entries */
+
+  h->tableSize = 64;
+  while(h->tableSize < 2 * n)
+    h->tableSize *= 2;
 
-  while(initTable[i] < n && i < primeTableLength)
-    i++;
+  h->table = (hashSlot*)malloc(h->tableSize * sizeof(hashSlot));
+  for(i = 0; i < h->tableSize; i++)
+    h->table[i].entry = -1;
 
-  assert(i < primeTableLength);
+  h->entries = 0;
+  h->entrySize = h->tableSize / 2;
+  h->entry = (stringEntry*)malloc(h->entrySize * sizeof(stringEntry));
 
-  tableSize = initTable[i];  
+  h->labelsUsed = 0;
+  h->labelsSize = 16 * (size_t)h->entrySize;
+  h->labels = (char*)malloc(h->labelsSize);
 
-  h->table = (stringEntry**)calloc(tableSize, sizeof(stringEntry*));
-  h->tableSize = tableSize;    
+  assert(h->table && h->entry && h->labels);
 
   return h;
 }
 
 
-static hashNumberType  hashString(char *p, hashNumberType tableSize)
+/* 
+   consumes the label 8 bytes at a time, labels with long common prefixes 
+   such as OTU_000001 ... are only told apart by the final mixing step 
+*/
+
+static hashNumberType  hashString(char *p, size_t length)
 {
-  hashNumberType h = 0;
+  const uint64_t 
+    m = 0x9e3779b97f4a7c15ULL;
+
+  uint64_t 
+    h = (uint64_t)length * m,
+    w;
   
-  for(; *p; p++)
-    h = 31 * h + *p;
+  for(; length >= 8; p += 8, length -= 8)
+    {
+      memcpy(&w, p, 8);
+      h = (h ^ w) * m;
+      h ^= h >> 32;
+    }
+
+  if(length > 0)
+    {
+      w = 0;
+      memcpy(&w, p, length);
+      h = (h ^ w) * m;
+    }
+
+  /* final avalanche as in MurmurHash3 */
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
   
-  return (h % tableSize);
+  return (hashNumberType)h;
 }
 
- 
+static char *hashWord(stringHashtable *h, int entryIndex)
+{
+  return &(h->labels[h->entry[entryIndex].wordOffset]);
+}
+
+/* 
+   the number of taxa is not known in advance when the tree is read in one pass,
+   hence we double the table once it is half full, since the slots store the 
+   hash values the labels need not be re-hashed and the entries do not move
+*/
 
-static void addword(char *s, stringHashtable *h, int nodeNumber)
+static void growStringHashTable(stringHashtable *h)
 {
-  hashNumberType position = hashString(s, h->tableSize);
-  stringEntry *p = h->table[position];
-  
-  for(; p!= NULL; p = p->next)
+  hashSlot
+    *old = h->table;
+
+  hashNumberType 
+    i,
+    oldSize = h->tableSize,
+    mask,
+    position;
+
+  h->tableSize *= 2;
+  h->table = (hashSlot*)malloc(h->tableSize * sizeof(hashSlot));
+  assert(h->table);
+
+  for(i = 0; i < h->tableSize; i++)
+    h->table[i].entry = -1;
+
+  mask = h->tableSize - 1;
+
+  for(i = 0; i < oldSize; i++)
+    if(old[i].entry != -1)
+      {
+	for(position = old[i].hash & mask; h->table[position].entry != -1; position = (position + 1) & mask)
+	  ;
+	h->table[position] = old[i];
+      }
+
+  free(old);
+}
+
+static void freeStringHashTable(stringHashtable *h)
+{
+  free(h->table);
+  free(h->entry);
+  free(h->labels);
+  free(h);
+}
+
+/* empties the table for the next tree of a collection, keeps all buffers */
+
+static void clearStringHashTable(stringHashtable *h)
+{
+  hashNumberType 
+    i;
+
+  for(i = 0; i < h->tableSize; i++)
+    h->table[i].entry = -1;
+
+  h->entries    = 0;
+  h->labelsUsed = 0;
+}
+
+/* 
+   looks up the length bytes at s (not necessarily '\0' terminated) and 
+   inserts them with nodeNumber if they are not there yet, returns the node 
+   number stored with s, i.e., a return value different from nodeNumber 
+   means that s is a duplicate 
+*/
+
+static int internWord(char *s, size_t length, stringHashtable *h, int nodeNumber)
+{
+  hashNumberType 
+    hash = hashString(s, length),
+    mask = h->tableSize - 1,
+    position;
+
+  int 
+    e;
+
+  for(position = hash & mask; (e = h->table[position].entry) != -1; position = (position + 1) & mask)
     {
-      if(strcmp(s, p->word) == 0)		 
-	return;	  	
+      if(h->table[position].hash == hash && h->entry[e].length == length && memcmp(s, hashWord(h, e), length) == 0)		 
+	return h->entry[e].nodeNumber;	  	
     }
 
-  p = (stringEntry *)malloc(sizeof(stringEntry));
+  if(h->entries == h->entrySize)
+    {
+      h->entrySize *= 2;
+      h->entry = (stringEntry*)realloc(h->entry, h->entrySize * sizeof(stringEntry));
+      assert(h->entry);
+    }
 
-  assert(p);
-  
-  p->nodeNumber = nodeNumber;
-  p->word = (char *)malloc((strlen(s) + 1) * sizeof(char));
+  while(h->labelsUsed + length + 1 > h->labelsSize)
+    {
+      h->labelsSize *= 2;
+      h->labels = (char*)realloc(h->labels, h->labelsSize);
+      assert(h->labels);
+    }
 
-  strcpy(p->word, s);
-  
-  p->next =  h->table[position];
-  
-  h->table[position] = p;
+  e = h->entries++;
+
+  h->entry[e].nodeNumber = nodeNumber;
+  h->entry[e].wordOffset = h->labelsUsed;
+  h->entry[e].length     = length;
+  memcpy(&(h->labels[h->labelsUsed]), s, length);
+  h->labels[h->labelsUsed + length] = '\0';
+  h->labelsUsed += length + 1;
+
+  h->table[position].hash  = hash;
+  h->table[position].entry = e;
+
+  if(2 * h->entries > h->tableSize)
+    growStringHashTable(h);
+
+  return nodeNumber;
+}
+
+
+
+static void initTreeReader(treeReader *rd, int fd)
+{
+  rd->fd          = fd;
+  rd->position    = 0;
+  rd->mark        = 0;
+  rd->marked      = FALSE;
+  rd->scratch     = (char *)NULL;
+  rd->scratchSize = 0;
+  rd->borrowed    = FALSE;
+  rd->ownsFd      = FALSE;
+  rd->messages    = stdout;
 }
 
-static int lookupWord(char *s, stringHashtable *h)
+/* reads from fd, which stays open, from its current offset on */
+
+static boolean openTreeReaderFd(treeReader *rd, int fd)
 {
-  hashNumberType position = hashString(s, h->tableSize);
-  stringEntry *p = h->table[position];
+  struct stat 
+    st;
+
+  void 
+    *m;
+
+  initTreeReader(rd, fd);
+
+  if(fstat(rd->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 && lseek(rd->fd, 0, SEEK_CUR) == 0)
+    {
+      m = mmap((void *)NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, rd->fd, 0);
+
+      if(m != MAP_FAILED)
+	{
+	  (void) madvise(m, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	  rd->buffer = (char *)m;
+	  rd->length = (size_t)st.st_size;
+	  rd->size   = (size_t)st.st_size;
+	  rd->mapped = TRUE;
+
+	  return TRUE;
+	}
+    }
   
-  for(; p!= NULL; p = p->next)
+  rd->mapped = FALSE;
+  rd->size   = READER_BUFFER_SIZE;
+  rd->length = 0;
+  rd->buffer = (char *)malloc(rd->size);
+
+  assert(rd->buffer);
+
+  return TRUE;
+}
+
+#ifndef TREECOUNTER_LIBRARY
+
+static boolean openTreeReader(treeReader *rd, const char *fileName)
+{
+  int 
+    fd = (strcmp(fileName, "-") == 0) ? 0 : open(fileName, O_RDONLY);
+
+  if(fd < 0 || !openTreeReaderFd(rd, fd))
+    return FALSE;
+
+  rd->ownsFd = (fd != 0);
+
+  return TRUE;
+}
+
+#endif
+
+static void openTreeReaderBuffer(treeReader *rd, const char *buffer, size_t length)
+{
+  initTreeReader(rd, -1);
+
+  rd->buffer   = (char *)buffer;
+  rd->length   = length;
+  rd->size     = length;
+  rd->mapped   = TRUE;
+  rd->borrowed = TRUE;
+}
+
+static void closeTreeReader(treeReader *rd)
+{
+  if(!rd->borrowed)
+    {
+      if(rd->mapped)
+	munmap(rd->buffer, rd->size);
+      else
+	free(rd->buffer);
+    }
+
+  free(rd->scratch);
+
+  if(rd->ownsFd)
+    close(rd->fd);
+}
+
+/* refill the read() window, returns FALSE at the end of the input */
+
+static boolean fillTreeReader(treeReader *rd)
+{
+  ssize_t 
+    n;
+
+  if(rd->mapped)
+    return FALSE;
+
+  if(rd->marked)
+    {
+      if(rd->mark == 0 && rd->length == rd->size)
+	{
+	  rd->size *= 2;
+	  rd->buffer = (char *)realloc(rd->buffer, rd->size);
+	  assert(rd->buffer);
+	}
+      else
+	{
+	  memmove(rd->buffer, &(rd->buffer[rd->mark]), rd->length - rd->mark);
+	  rd->length   -= rd->mark;
+	  rd->position -= rd->mark;
+	  rd->mark      = 0;
+	}
+    }
+  else
     {
-      if(strcmp(s, p->word) == 0)		 
-	return p->nodeNumber;	  	
+      rd->length   = 0;
+      rd->position = 0;
     }
 
-  return -1;
+  do
+    n = read(rd->fd, &(rd->buffer[rd->length]), rd->size - rd->length);
+  while(n < 0 && errno == EINTR);
+
+  if(n <= 0)
+    return FALSE;
+
+  rd->length += (size_t)n;
+
+  return TRUE;
+}
+
+static int readerGetc(treeReader *rd)
+{
+  if(rd->position == rd->length && !fillTreeReader(rd))
+    return EOF;
+
+  return (unsigned char)rd->buffer[rd->position++];
 }
 
+static void readerUngetc(int ch, treeReader *rd)
+{
+  if(ch != EOF)
+    rd->position--;
+}
 
 
-static int treeGetCh (FILE *fp)         /* get next nonblank, noncomment character */
+static int treeGetCh (treeReader *rd)         /* get next nonblank, noncomment character */
 { /* treeGetCh */
   int  ch;
 
-  while ((ch = getc(fp)) != EOF) {
+  while ((ch = readerGetc(rd)) != EOF) {
     if (whitechar(ch)) ;
     else if (ch == '[') {                   /* comment; find its end */
-      if ((ch = treeFinishCom(fp, (char **) NULL)) == EOF)  break;
+      if ((ch = treeFinishCom(rd, (char **) NULL)) == EOF)  break;
     }
     else  break;
   }
  return  ch;
 } /* treeGetCh */
 
-static boolean treeNeedCh (FILE *fp, int c1, char *where)
+static boolean treeNeedCh (treeReader *rd, int c1, char *where)
 {
   int  c2;
   
-  if ((c2 = treeGetCh(fp)) == c1)  return TRUE;
+  if ((c2 = treeGetCh(rd)) == c1)  return TRUE;
   
-  printf("ERROR: Expecting '%c' %s tree; found:", c1, where);
+  fprintf(rd->messages, "ERROR: Expecting '%c' %s tree; found:", c1, where);
   if (c2 == EOF) 
     {
-      printf("End-of-File");
+      fprintf(rd->messages, "End-of-File");
     }
   else 
     {      	
-      ungetc(c2, fp);
-      treeEchoContext(fp, stdout, 40);
+      readerUngetc(c2, rd);
+      treeEchoContext(rd, rd->messages, 40);
     }
-  putchar('\n');
+  fputc('\n', rd->messages);
 
   if(c1 == ':')    
-    printf("RAxML may be expecting to read a tree that contains branch lengths\n");
+    fprintf(rd->messages, "RAxML may be expecting to read a tree that contains branch lengths\n");
 
   return FALSE;
 } 
@@ -216,30 +586,28 @@ static boolean whitechar (int ch)
   return (ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r');
 }
 
-static int treeFinishCom (FILE *fp, char **strp)
+static int treeFinishCom (treeReader *rd, char **strp)
 {
-  int  ch;
+  int  ch, depth = 1;                     /* nesting depth instead of recursion */
   
-  while ((ch = getc(fp)) != EOF && ch != ']') {
-    if (strp != NULL) *(*strp)++ = ch;    /* save character  */
-    if (ch == '[') {                      /* nested comment; find its end */
-      if ((ch = treeFinishCom(fp, strp)) == EOF)  break;
-      if (strp != NULL) *(*strp)++ = ch;  /* save closing ]  */
-    }
+  while ((ch = readerGetc(rd)) != EOF) {
+    if (ch == ']' && --depth == 0)  break;
+    if (strp != NULL) *(*strp)++ = ch;    /* save character, nested brackets included  */
+    if (ch == '[')  depth++;              /* nested comment; find its end */
   }
   
   if (strp != NULL) **strp = '\0';        /* terminate string  */
   return  ch;
 } /* treeFinishCom */
 
-static void  treeEchoContext (FILE *fp1, FILE *fp2, int n)
+static void  treeEchoContext (treeReader *rd, FILE *fp2, int n)
 { /* treeEchoContext */
   int      ch;
   boolean  waswhite;
   
   waswhite = TRUE;
   
-  while (n > 0 && ((ch = getc(fp1)) != EOF)) {
+  while (n > 0 && ((ch = readerGetc(rd)) != EOF)) {
     if (whitechar(ch)) {
       ch = waswhite ? '\0' : ' ';
       waswhite = TRUE;
@@ -268,6 +636,7 @@ static boolean treeLabelEnd (int ch)
     case '(':   
     case ')':  
     case ';':
+    case '[':                  /* a comment, skipped by treeGetCh() as in the count-only engine */
       return TRUE;
     default:
       break;
@@ -276,25 +645,29 @@ static boolean treeLabelEnd (int ch)
 } 
 
 
-static boolean  treeGetLabel (FILE *fp, char *lblPtr, int maxlen)
+/* 
+   reads a label and optionally returns it as a view into the input buffer 
+   that remains valid until the next read from rd, there is no length limit 
+*/
+
+static boolean  treeGetLabel (treeReader *rd, char **lblPtr, size_t *length)
 {
   int      ch;
-  boolean  done, quoted, lblfound;
-
-  if (--maxlen < 0) 
-    lblPtr = (char *) NULL; 
-  else 
-    if (lblPtr == NULL) 
-      maxlen = 0;
+  boolean  done, quoted, lblfound, escaped = FALSE;
+  size_t   start, i, j;
 
-  ch = getc(fp);
+  ch = readerGetc(rd);
   done = treeLabelEnd(ch);
 
   lblfound = ! done;
   quoted = (ch == '\'');
+
+  rd->mark   = (ch == EOF) ? rd->position : rd->position - 1;
+  rd->marked = TRUE;
+
   if (quoted && ! done) 
     {
-      ch = getc(fp); 
+      ch = readerGetc(rd); 
       done = (ch == EOF);
     }
 
@@ -304,696 +677,6155 @@ static boolean  treeGetLabel (FILE *fp, char *lblPtr, int maxlen)
 	{
 	  if (ch == '\'') 
 	    {
-	      ch = getc(fp); 
+	      ch = readerGetc(rd); 
 	      if (ch != '\'') 
 		break;
+	      escaped = TRUE;
 	    }
         }
       else 
 	if (treeLabelEnd(ch)) break;     
 
-      if (--maxlen >= 0) *lblPtr++ = ch;
-      ch = getc(fp);
+      ch = readerGetc(rd);
       if (ch == EOF) break;
     }
 
-  if (ch != EOF)  (void) ungetc(ch, fp);
+  if (ch != EOF)  (void) readerUngetc(ch, rd);
+
+  rd->marked = FALSE;
+
+  if (lblPtr != NULL) 
+    {
+      start   = rd->mark;
+      *length = rd->position - start;
+
+      if(quoted)
+	{
+	  /* strip the quotes, there is no closing one if we hit EOF */
+
+	  start++;
+	  *length -= (*length > 1 && rd->buffer[rd->position - 1] == '\'') ? 2 : 1;
+	}
+
+      *lblPtr = &(rd->buffer[start]);
+
+      if(escaped)
+	{
+	  /* a doubled '' inside a quoted label denotes one quote, we can not unescape in place */
+
+	  if(rd->scratchSize < *length)
+	    {
+	      rd->scratchSize = 2 * *length;
+	      rd->scratch = (char *)realloc(rd->scratch, rd->scratchSize);
+	      assert(rd->scratch);
+	    }
+
+	  for(i = 0, j = 0; i < *length; i++, j++)
+	    {
+	      rd->scratch[j] = (*lblPtr)[i];
+	      if((*lblPtr)[i] == '\'')
+		i++;
+	    }
 
-  if (lblPtr != NULL) *lblPtr = '\0';
+	  *lblPtr = rd->scratch;
+	  *length = j;
+	}
+    }
 
   return lblfound;
 }
 
 
-static boolean  treeFlushLabel (FILE *fp)
+static boolean  treeFlushLabel (treeReader *rd)
 { 
-  return  treeGetLabel(fp, (char *) NULL, (int) 0);
+  return  treeGetLabel(rd, (char **) NULL, (size_t *) NULL);
 } 
 
-static int treeFindTipByLabelString(char  *str, tree *tr)                    
+
+#ifndef TREECOUNTER_LIBRARY
+static char cacheFileName[2048] = "";
+static char socketFileName[2048] = "";
+#endif
+static char resultCacheDir[2048] = "";
+
+/* the batch mode and the library print nothing but their results */
+
+#ifdef TREECOUNTER_LIBRARY
+static boolean reportProducts = FALSE;
+#else
+static boolean reportProducts = TRUE;
+#endif
+
+/* 
+   appends a new node as last child of the open node f, the arrays are 
+   indexed, hence we can simply realloc() them as the tree grows 
+*/
+
+static uint32_t addTopologyNode(topology *t, parseFrame *f)
 {
-  int lookup = lookupWord(str, tr->nameHash);
+  uint32_t 
+    n;
 
-  if(lookup > 0)
+  if(t->nodes == t->size)
     {
-      assert(! tr->nodep[lookup]->back);
-      return lookup;
+      assert(t->size < NO_NODE / 2);
+
+      t->size *= 2;
+      t->parent     = (uint32_t *)realloc(t->parent, t->size * sizeof(uint32_t));
+      t->firstChild = (uint32_t *)realloc(t->firstChild, t->size * sizeof(uint32_t));
+      t->sibling    = (uint32_t *)realloc(t->sibling, t->size * sizeof(uint32_t));
+      t->taxon      = (uint32_t *)realloc(t->taxon, t->size * sizeof(uint32_t));
+
+      if(!t->parent || !t->firstChild || !t->sibling || !t->taxon)
+	{
+	  printf("ERROR: Unable to obtain sufficient tree memory\n");
+	  exit(-1);
+	}
     }
+
+  n = t->nodes++;
+
+  t->firstChild[n] = NO_NODE;
+  t->sibling[n]    = NO_NODE;
+  t->taxon[n]      = 0;
+
+  if(f == (parseFrame *)NULL)
+    t->parent[n] = NO_NODE;
   else
-    { 
-      printf("ERROR: Cannot find tree species: %s\n", str);
-      return  0;
+    {
+      t->parent[n] = f->node;
+
+      if(f->lastChild == NO_NODE)
+	t->firstChild[f->node] = n;
+      else
+	t->sibling[f->lastChild] = n;
+
+      f->lastChild = n;
     }
-}
 
-static int randomInt(int n)
-{
-  return rand() %n;
+  return n;
 }
 
+/* 
+   taxa are discovered while reading the topology, i.e., the tip numbers 
+   are assigned in the order in which the labels appear in the tree 
+*/
 
-static int treeFindTipName(FILE *fp, tree *tr)
+static int treeFindTipName(treeReader *rd, tree *tr)
 {
-  char    str[nmlngth+2];
+  char    *str;
+  size_t   length;
   int      n;
 
-  if(treeGetLabel(fp, str, nmlngth+2))
-    n = treeFindTipByLabelString(str, tr);
-  else
-    n = 0;
-   
+  if(!treeGetLabel(rd, &str, &length))
+    {
+      fprintf(rd->messages, "ERROR: Expecting a taxon label in constraint tree; found:");
+      treeEchoContext(rd, rd->messages, 40);
+      fprintf(rd->messages, "\n");
+      return 0;
+    }
+
+  n = tr->ntips + 1;
+
+  if(internWord(str, length, tr->nameHash, n) != n)
+    {
+      if(tr->batch)
+	fprintf(rd->messages, "A taxon labelled by %.*s appears twice in tree %lld of tree collection %s\n", (int)length, str, tr->treeIndex, tr->fileName);
+      else
+	fprintf(rd->messages, "A taxon labelled by %.*s appears twice in the first tree of tree collection %s\n", (int)length, str, tr->fileName);
+      tr->status = TREE_COUNTER_DUPLICATE_TAXON;
+      return 0;
+    }
+
+  tr->ntips = n;
 
   return  n;
 } 
 
-static boolean treeProcessLength (FILE *fp, double *dptr)
+/* 
+   validates the lexical shape [+-]digits[.digits][(e|E)[+-]digits] of a 
+   branch length, where either the integer or the fractional digits may be 
+   missing. The number is only converted if dptr is not NULL, i.e., when 
+   the value is actually needed, otherwise it is skipped without parsing
+*/
+
+static boolean treeProcessLength (treeReader *rd, double *dptr)
 {
   int  ch;
+  size_t digits = 0, length;
+  boolean valid;
   
-  if ((ch = treeGetCh(fp)) == EOF)  return FALSE;    /*  Skip comments */
-  (void) ungetc(ch, fp);
+  if ((ch = treeGetCh(rd)) == EOF)  return FALSE;    /*  Skip comments */
+
+  rd->mark   = rd->position - 1;
+  rd->marked = TRUE;
+
+  if (ch == '+' || ch == '-')  ch = readerGetc(rd);
+
+  for(; isdigit(ch); digits++)  ch = readerGetc(rd);
+
+  if (ch == '.')
+    for(ch = readerGetc(rd); isdigit(ch); digits++)  ch = readerGetc(rd);
+
+  valid = (digits > 0);
+
+  if (valid && (ch == 'e' || ch == 'E'))
+    {
+      ch = readerGetc(rd);
+      if (ch == '+' || ch == '-')  ch = readerGetc(rd);
+      
+      for(digits = 0; isdigit(ch); digits++)  ch = readerGetc(rd);
+      
+      valid = (digits > 0);
+    }
   
-  if (fscanf(fp, "%lf", dptr) != 1) {
-    printf("ERROR: treeProcessLength: Problem reading branch length\n");
-    treeEchoContext(fp, stdout, 40);
-    printf("\n");
+  (void) readerUngetc(ch, rd);
+  rd->marked = FALSE;
+
+  if (!valid) {
+    fprintf(rd->messages, "ERROR: treeProcessLength: Problem reading branch length\n");
+    rd->position = rd->mark;
+    treeEchoContext(rd, rd->messages, 40);
+    fprintf(rd->messages, "\n");
     return  FALSE;
   }
+
+  if (dptr != NULL)
+    {
+      /* strtod() needs a terminated copy, the buffer may be a read-only mapping */
+
+      length = rd->position - rd->mark;
+
+      if(rd->scratchSize < length + 1)
+	{
+	  rd->scratchSize = 2 * (length + 1);
+	  rd->scratch = (char *)realloc(rd->scratch, rd->scratchSize);
+	  assert(rd->scratch);
+	}
+
+      memcpy(rd->scratch, &(rd->buffer[rd->mark]), length);
+      rd->scratch[length] = '\0';
+
+      *dptr = strtod(rd->scratch, (char **)NULL);
+    }
   
   return  TRUE;
 }
 
 
-static int treeFlushLen (FILE  *fp)
+static int treeFlushLen (treeReader *rd)
 {
-  double  dummy;  
   int     ch;
   
-  ch = treeGetCh(fp);
+  ch = treeGetCh(rd);
   
   if (ch == ':') 
     {
-      ch = treeGetCh(fp);
+      ch = treeGetCh(rd);
       
-      ungetc(ch, fp);
-      if(!treeProcessLength(fp, & dummy)) return 0;
+      readerUngetc(ch, rd);
+      if(!treeProcessLength(rd, (double *)NULL)) return 0;
       return 1;	  
     }
   
   
   
-  if (ch != EOF) (void) ungetc(ch, fp);
+  if (ch != EOF) (void) readerUngetc(ch, rd);
   return 1;
 } 
 
 
-static void extractTaxaFromTopology(tree *tr, char *fileName)
-{
-  FILE *f = fopen(fileName, "rb");
+/* 
+   reads the constraint tree into tr->topo, open inner nodes are kept on an 
+   explicit stack of parseFrames, i.e., the depth of the tree is only 
+   bounded by the heap and not by the call stack 
+*/
 
-  char 
-    **nameList,
-    buffer[nmlngth + 2]; 
+static boolean readTopology (treeReader *rd, tree *tr)
+{ 
+  topology
+    *t = &(tr->topo);
 
-  int
-    i = 0,
-    c,
-    taxaSize = 1024,
-    taxaCount = 0;
-   
-  nameList = (char**)malloc(sizeof(char*) * taxaSize);  
+  uint32_t 
+    n;
+
+  int      
+    taxon, 
+    ch, 
+    depth = 0;
 
-  while((c = fgetc(f)) != ';')
+  for(;;)
     {
-      if(c == '(' || c == ',')
+      if ((ch = treeGetCh(rd)) == '(') 
+	{     
+	  if(depth == tr->frameSize)
+	    {
+	      tr->frameSize *= 2;
+	      tr->frames = (parseFrame *)realloc(tr->frames, tr->frameSize * sizeof(parseFrame));
+	      assert(tr->frames);
+	    }
+
+	  n = addTopologyNode(t, (depth == 0) ? (parseFrame *)NULL : &(tr->frames[depth - 1]));
+
+	  tr->frames[depth].node      = n;
+	  tr->frames[depth].lastChild = NO_NODE;
+	  depth++;
+
+	  continue;
+	}
+
+      if(depth == 0)
+	{
+	  if(ch == EOF)
+	    {
+	      fprintf(rd->messages, "ERROR: Constraint tree %s does not contain an opening parenthesis\n", tr->fileName);
+	      return FALSE;
+	    }
+	  continue;
+	}
+      
+      readerUngetc(ch, rd);
+      if ((taxon = treeFindTipName(rd, tr)) <= 0)          return FALSE;
+
+      n = addTopologyNode(t, &(tr->frames[depth - 1]));
+      t->taxon[n] = (uint32_t)taxon;
+  
+      if(!treeFlushLen(rd)) return FALSE;
+
+      /* the element is complete, close all inner nodes that end here */
+
+      for(;;)
+	{
+	  if((ch = treeGetCh(rd)) == ',')
+	    break;
+
+	  if(ch != ')')
+	    {
+	      fprintf(rd->messages, "Missing /) in treeReadLenMULT\n");
+	      return FALSE;
+	    }
+	
+	  (void) treeFlushLabel(rd);
+	  if(!treeFlushLen(rd)) return FALSE;
+
+	  if(--depth == 0)
+	    return treeNeedCh(rd, ';', "at end of");
+	}
+    }
+} 
+
+
+/* 
+   k!! for odd k, GMP 5.1 and later provide a subquadratic implementation, 
+   otherwise we compute the product of the odd numbers by binary splitting 
+   such that the big multiplications operate on balanced operands 
+*/
+
+#if __GNU_MP_VERSION > 5 || (__GNU_MP_VERSION == 5 && __GNU_MP_VERSION_MINOR >= 1)
+#define HAVE_MPZ_2FAC
+#endif
+
+#define PRODUCT_LEAF 32
+
+/* product of the odd numbers lo, lo + 2, ..., hi */
+
+static void oddProduct(mpz_t r, unsigned long int lo, unsigned long int hi)
+{
+  unsigned long int 
+    mid;
+
+  mpz_t
+    right;
+
+  if(hi < lo + 2 * PRODUCT_LEAF)
+    {
+      mpz_set_ui(r, 1);
+      for(; lo <= hi; lo += 2)
+	mpz_mul_ui(r, r, lo);
+      return;
+    }
+
+  mid = lo + 2 * ((hi - lo) / 4);
+
+  mpz_init(right);
+
+  oddProduct(r, lo, mid);
+  oddProduct(right, mid + 2, hi);
+  mpz_mul(r, r, right);
+
+  mpz_clear(right);
+}
+
+static void doubleFactorial(mpz_t r, unsigned long int k)
+{
+#ifdef HAVE_MPZ_2FAC
+  mpz_2fac_ui(r, k);
+#else
+  if(k < 3)
+    mpz_set_ui(r, 1);
+  else
+    oddProduct(r, 1, k);
+#endif
+}
+
+/* 
+   optional read-only cache of odd double factorials that is memory mapped 
+   from disk, the file stores D(m) = (2m - 1)!! for all m < CACHE_DENSE and 
+   for checkpoints that grow geometrically by a factor of 1 + 1/CACHE_STEP 
+   beyond that. A double factorial is then computed from the largest 
+   checkpoint below it, the cached limbs are used in place via 
+   mpz_roinit_n() without copying them.
+
+   Layout: a cacheHeader, the limbs of all values and the table of 
+   cacheEntry records sorted by m at tableOffset. The file is only valid 
+   on machines with the same limb size and byte order. 
+*/
+
+#if __GNU_MP_VERSION >= 6
+#define HAVE_MPZ_LIMBS
+#endif
+
+#define CACHE_MAGIC      "TCDFC01"
+#define CACHE_BYTE_ORDER 0x01020304
+#define CACHE_DENSE      256
+#define CACHE_STEP       8
+
+typedef struct
+{
+  char     magic[8];
+  uint32_t limbBytes;
+  uint32_t byteOrder;
+  uint64_t count;
+  uint64_t tableOffset;
+}
+  cacheHeader;
+
+typedef struct
+{
+  uint64_t m;
+  uint64_t offset;
+  uint64_t limbs;
+}
+  cacheEntry;
+
+typedef struct
+{
+  char             *map;
+  size_t            mapSize;
+  const cacheEntry *entries;
+  uint64_t          count;
+}
+  doubleFactorialCache;
+
+static doubleFactorialCache dfCache;
+
+static boolean openDoubleFactorialCache(const char *fileName)
+{
+#ifdef HAVE_MPZ_LIMBS
+  struct stat 
+    st;
+
+  const cacheHeader
+    *h;
+
+  uint64_t
+    i;
+
+  int
+    fd = open(fileName, O_RDONLY);
+
+  void 
+    *m = MAP_FAILED;
+
+  if(fd < 0)
+    return FALSE;
+
+  if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(cacheHeader))
+    m = mmap((void *)NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+  close(fd);
+
+  if(m == MAP_FAILED)
+    return FALSE;
+
+  h = (const cacheHeader *)m;
+
+  dfCache.map     = (char *)m;
+  dfCache.mapSize = (size_t)st.st_size;
+  dfCache.count   = h->count;
+  dfCache.entries = (const cacheEntry *)(dfCache.map + h->tableOffset);
+
+  if(memcmp(h->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || h->limbBytes != sizeof(mp_limb_t) || 
+     h->byteOrder != CACHE_BYTE_ORDER || h->tableOffset % sizeof(uint64_t) != 0 || h->tableOffset > dfCache.mapSize ||
+     h->count > (dfCache.mapSize - h->tableOffset) / sizeof(cacheEntry))
+    goto invalid;
+
+  for(i = 0; i < dfCache.count; i++)
+    {
+      const cacheEntry 
+	*e = &(dfCache.entries[i]);
+
+      if(e->offset % sizeof(mp_limb_t) != 0 || e->limbs == 0 || e->offset > h->tableOffset ||
+	 e->limbs > (h->tableOffset - e->offset) / sizeof(mp_limb_t) || (i > 0 && e->m <= dfCache.entries[i - 1].m))
+	goto invalid;
+    }
+
+  return TRUE;
+
+ invalid:
+  munmap(dfCache.map, dfCache.mapSize);
+  memset(&dfCache, 0, sizeof(dfCache));
+
+  return FALSE;
+#else
+  (void) fileName;
+
+  return FALSE;
+#endif
+}
+
+static void closeDoubleFactorialCache(void)
+{
+  if(dfCache.map)
+    munmap(dfCache.map, dfCache.mapSize);
+
+  memset(&dfCache, 0, sizeof(dfCache));
+}
+
+/* 
+   the checkpoint to start (2m - 1)!! from, NULL if there is none or if it 
+   is so far below m that the remaining product is more expensive than 
+   computing the whole double factorial from scratch
+*/
+
+static const cacheEntry *findCheckpoint(unsigned long int m)
+{
+  uint64_t
+    lo = 0,
+    hi = dfCache.count,
+    mid;
+
+  while(lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+
+      if(dfCache.entries[mid].m <= m)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  if(lo == 0 || 4 * (m - dfCache.entries[lo - 1].m) > m)
+    return (const cacheEntry *)NULL;
+
+  return &(dfCache.entries[lo - 1]);
+}
+
+#ifdef HAVE_MPZ_LIMBS
+static mpz_srcptr checkpointValue(mpz_t view, const cacheEntry *e)
+{
+  return mpz_roinit_n(view, (const mp_limb_t *)(dfCache.map + e->offset), (mp_size_t)e->limbs);
+}
+#endif
+
+/* k!! for odd k, starting from the nearest cached checkpoint if there is one */
+
+static void cachedDoubleFactorial(mpz_t r, unsigned long int k)
+{
+#ifdef HAVE_MPZ_LIMBS
+  const cacheEntry
+    *e = (k < 3 || !dfCache.map) ? (const cacheEntry *)NULL : findCheckpoint((k + 1) / 2);
+
+  mpz_t
+    view;
+
+  if(e)
+    {
+      if(2 * e->m - 1 == k)
+	mpz_set(r, checkpointValue(view, e));
+      else
+	{
+	  oddProduct(r, (unsigned long int)(2 * e->m + 1), k);
+	  mpz_mul(r, r, checkpointValue(view, e));
+	}
+      return;
+    }
+#endif
+
+  doubleFactorial(r, k);
+}
+
+
+/* 
+   the constraint count is a product over all polytomies, instead of one 
+   machine word factor (2k - 3)!! per polytomy, which overflows for k > 20, 
+   we record how often every degree k occurs and compute each distinct 
+   double factorial only once in arbitrary precision, raised to the power 
+   of its multiplicity. Small degrees are counted in a fixed table, the few 
+   polytomies with DENSE_DEGREES or more children (there are at most 
+   taxa / DENSE_DEGREES of them) are listed individually such that the 
+   memory does not depend on the size of the largest polytomy.
+*/
+
+#define DENSE_DEGREES 4096
+
+typedef struct degreeHistogram
+{
+  unsigned long int  dense[DENSE_DEGREES];
+  int               *large;
+  size_t             largeCount;
+  size_t             largeSize;
+  int                max;
+}
+  degreeHistogram;
+
+typedef struct
+{
+  unsigned long int degree;
+  unsigned long int multiplicity;
+}
+  degreePower;
+
+static degreeHistogram *initDegreeHistogram(void)
+{
+  degreeHistogram 
+    *h = (degreeHistogram *)calloc(1, sizeof(degreeHistogram));
+
+  assert(h);
+
+  h->largeSize = 16;
+  h->large     = (int *)malloc(sizeof(int) * h->largeSize);
+
+  return h;
+}
+
+/* only the degrees up to the maximum may have been counted */
+
+static void clearDegreeHistogram(degreeHistogram *h)
+{
+  int 
+    top = (h->max < DENSE_DEGREES) ? h->max : DENSE_DEGREES - 1;
+
+  memset(h->dense, 0, sizeof(unsigned long int) * (size_t)(top + 1));
+
+  h->largeCount = 0;
+  h->max        = 0;
+}
+
+/* the histogram of the tree that is read, reused for all trees of a collection */
+
+static degreeHistogram *treeHistogram(tree *tr)
+{
+  if(tr->histogram == (degreeHistogram *)NULL)
+    tr->histogram = initDegreeHistogram();
+  else
+    clearDegreeHistogram(tr->histogram);
+
+  return tr->histogram;
+}
+
+static void freeDegreeHistogram(degreeHistogram *h)
+{
+  free(h->large);
+  free(h);
+}
+
+/* count polytomies with degree children, degrees below 3 have a single resolution */
+
+static void addDegree(degreeHistogram *h, int degree, unsigned long int count)
+{
+  if(degree < 3 || count == 0)
+    return;
+
+  if(degree > h->max)
+    h->max = degree;
+
+  if(degree < DENSE_DEGREES)
+    {
+      h->dense[degree] += count;
+      return;
+    }
+
+  for(; count > 0; count--)
+    {
+      if(h->largeCount == h->largeSize)
+	{
+	  h->largeSize *= 2;
+	  h->large = (int *)realloc(h->large, sizeof(int) * h->largeSize);
+	  assert(h->large);
+	}
+
+      h->large[h->largeCount++] = degree;
+    }
+}
+
+static void mergeDegreeHistogram(degreeHistogram *h, const degreeHistogram *other)
+{
+  size_t
+    i;
+
+  int
+    k;
+
+  for(k = 3; k < DENSE_DEGREES; k++)
+    addDegree(h, k, other->dense[k]);
+
+  for(i = 0; i < other->largeCount; i++)
+    addDegree(h, other->large[i], 1);
+}
+
+/* product of ((2k - 3)!!)^m over powers[lo] ... powers[hi - 1] by binary splitting */
+
+static void powerProduct(mpz_t r, const degreePower *powers, size_t lo, size_t hi)
+{
+  size_t 
+    mid;
+
+  mpz_t
+    right;
+
+  if(hi == lo)
+    {
+      mpz_set_ui(r, 1);
+      return;
+    }
+
+  if(hi - lo == 1)
+    {
+      cachedDoubleFactorial(r, 2 * powers[lo].degree - 3);
+      mpz_pow_ui(r, r, powers[lo].multiplicity);
+      return;
+    }
+
+  mid = lo + (hi - lo) / 2;
+
+  mpz_init(right);
+
+  powerProduct(r, powers, lo, mid);
+  powerProduct(right, powers, mid, hi);
+  mpz_mul(r, r, right);
+
+  mpz_clear(right);
+}
+
+/* 
+   multithreaded product tree: the factors are split into leaves that are 
+   computed by binary splitting, the leaves and the inner nodes of the 
+   (heap ordered) tree that combines them pairwise are tasks of a small 
+   thread pool. A combine becomes ready as soon as both of its operands 
+   are available, such that the large multiplications close to the root 
+   run concurrently with the remaining leaves.
+*/
+
+#define LEAVES_PER_THREAD 4
+
+typedef void (*leafProduct)(mpz_t r, const void *data, size_t leaf, size_t leaves);
+
+typedef struct
+{
+  mpz_t           *value;
+  int             *pending;
+  size_t          *queue;
+  size_t           queued;
+  size_t           leaves;
+  boolean          finished;
+  leafProduct      leaf;
+  const void      *data;
+  pthread_mutex_t  mutex;
+  pthread_cond_t   ready;
+}
+  productPool;
+
+typedef struct
+{
+  unsigned long int lo;
+  unsigned long int hi;
+}
+  oddRange;
+
+typedef struct
+{
+  const degreePower *powers;
+  size_t             count;
+}
+  powerArray;
+
+static void oddRangeLeaf(mpz_t r, const void *data, size_t leaf, size_t leaves)
+{
+  const oddRange 
+    *range = (const oddRange *)data;
+
+  unsigned long int 
+    m = (range->hi - range->lo) / 2 + 1,
+    first = (unsigned long int)(leaf * m / leaves),
+    last = (unsigned long int)((leaf + 1) * m / leaves);
+
+  if(first == last)
+    mpz_set_ui(r, 1);
+  else
+    oddProduct(r, range->lo + 2 * first, range->lo + 2 * (last - 1));
+}
+
+static void powerArrayLeaf(mpz_t r, const void *data, size_t leaf, size_t leaves)
+{
+  const powerArray
+    *a = (const powerArray *)data;
+
+  powerProduct(r, a->powers, leaf * a->count / leaves, (leaf + 1) * a->count / leaves);
+}
+
+static void *productWorker(void *arg)
+{
+  productPool 
+    *pp = (productPool *)arg;
+
+  size_t 
+    t,
+    parent;
+
+  for(;;)
+    {
+      pthread_mutex_lock(&(pp->mutex));
+
+      while(pp->queued == 0 && !pp->finished)
+	pthread_cond_wait(&(pp->ready), &(pp->mutex));
+
+      if(pp->queued == 0)
+	{
+	  pthread_mutex_unlock(&(pp->mutex));
+	  return (void *)NULL;
+	}
+
+      t = pp->queue[--(pp->queued)];
+
+      pthread_mutex_unlock(&(pp->mutex));
+
+      if(t >= pp->leaves - 1)
+	pp->leaf(pp->value[t], pp->data, t - (pp->leaves - 1), pp->leaves);
+      else
+	{
+	  mpz_mul(pp->value[t], pp->value[2 * t + 1], pp->value[2 * t + 2]);
+	  mpz_set_ui(pp->value[2 * t + 1], 0);
+	  mpz_set_ui(pp->value[2 * t + 2], 0);
+	}
+
+      pthread_mutex_lock(&(pp->mutex));
+
+      if(t == 0)
+	{
+	  pp->finished = TRUE;
+	  pthread_cond_broadcast(&(pp->ready));
+	}
+      else
+	{
+	  parent = (t - 1) / 2;
+	  
+	  if(--(pp->pending[parent]) == 0)
+	    {
+	      pp->queue[pp->queued++] = parent;
+	      pthread_cond_signal(&(pp->ready));
+	    }
+	}
+
+      pthread_mutex_unlock(&(pp->mutex));
+    }
+}
+
+static double wallClock(void)
+{
+  struct timespec 
+    ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1.0e9;
+}
+
+/* with one thread the calling thread simply processes the single leaf */
+
+static void parallelProduct(mpz_t r, leafProduct leaf, const void *data, size_t factors, int threads)
+{
+  productPool 
+    pp;
+
+  pthread_t
+    *workers;
+
+  size_t
+    tasks,
+    t;
+
+  int 
+    i,
+    started = 0;
+
+  double
+    start = wallClock();
+
+  pp.leaves = (threads > 1) ? (size_t)threads * LEAVES_PER_THREAD : 1;
+  if(pp.leaves > factors)
+    pp.leaves = (factors > 0) ? factors : 1;
+
+  tasks = 2 * pp.leaves - 1;
+
+  pp.value   = (mpz_t *)malloc(tasks * sizeof(mpz_t));
+  pp.pending = (int *)malloc(tasks * sizeof(int));
+  pp.queue   = (size_t *)malloc(tasks * sizeof(size_t));
+  pp.queued  = 0;
+  pp.finished = FALSE;
+  pp.leaf    = leaf;
+  pp.data    = data;
+
+  for(t = 0; t < tasks; t++)
+    {
+      mpz_init(pp.value[t]);
+      pp.pending[t] = 2;
+      if(t >= pp.leaves - 1)
+	pp.queue[pp.queued++] = t;
+    }
+
+  pthread_mutex_init(&(pp.mutex), (pthread_mutexattr_t *)NULL);
+  pthread_cond_init(&(pp.ready), (pthread_condattr_t *)NULL);
+
+  if(threads > 1)
+    {
+      workers = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+
+      /* the workers share the queue, fewer threads than requested still compute the whole product */
+
+      for(i = 0; i < threads; i++, started++)
+	if(pthread_create(&workers[i], (pthread_attr_t *)NULL, productWorker, (void *)&pp) != 0)
+	  break;
+
+      if(started == 0)
+	productWorker((void *)&pp);
+
+      for(i = 0; i < started; i++)
+	pthread_join(workers[i], (void **)NULL);
+
+      free(workers);
+
+      /* a diagnostic, kept off standard output such that the counts can be parsed */
+
+      if(reportProducts)
+	fprintf(stderr, "Product of %lu factors computed with %d threads in %f seconds wall clock time\n", (unsigned long)factors, (started > 0) ? started : 1, wallClock() - start);
+    }
+  else
+    productWorker((void *)&pp);
+
+  mpz_swap(r, pp.value[0]);
+
+  for(t = 0; t < tasks; t++)
+    mpz_clear(pp.value[t]);
+
+  pthread_mutex_destroy(&(pp.mutex));
+  pthread_cond_destroy(&(pp.ready));
+
+  free(pp.value);
+  free(pp.pending);
+  free(pp.queue);
+}
+
+/* product of the odd numbers lo, lo + 2, ..., hi with lo <= hi */
+
+static void parallelOddProduct(mpz_t r, unsigned long int lo, unsigned long int hi, int threads)
+{
+  oddRange
+    range;
+
+  range.lo = lo;
+  range.hi = hi;
+
+  parallelProduct(r, oddRangeLeaf, (const void *)&range, (size_t)((hi - lo) / 2 + 1), threads);
+}
+
+/* k!! for odd k for -n, the remaining product above the checkpoint is computed on the thread pool */
+
+static void oddDoubleFactorial(mpz_t r, unsigned long int k, int threads)
+{
+  const cacheEntry
+    *e = (k < 3 || !dfCache.map) ? (const cacheEntry *)NULL : findCheckpoint((k + 1) / 2);
+
+  if(threads == 1 || k < 3 || (e && 2 * e->m - 1 == k))
+    {
+      cachedDoubleFactorial(r, k);
+      return;
+    }
+
+  if(!e)
+    {
+      parallelOddProduct(r, 1, k, threads);
+      return;
+    }
+
+#ifdef HAVE_MPZ_LIMBS
+  {
+    mpz_t
+      view;
+
+    parallelOddProduct(r, (unsigned long int)(2 * e->m + 1), k, threads);
+    mpz_mul(r, r, checkpointValue(view, e));
+  }
+#endif
+}
+
+#ifndef TREECOUNTER_LIBRARY
+
+/* 
+   writes the checkpoints required for trees with up to maxTaxa taxa to a 
+   temporary file that is renamed to fileName afterwards, such that 
+   concurrent runs never map a partially written cache
+*/
+
+static boolean writeDoubleFactorialCache(const char *fileName, unsigned long int maxTaxa, int threads)
+{
+#ifdef HAVE_MPZ_LIMBS
+  char 
+    tmpName[2100];
+
+  FILE 
+    *f;
+
+  cacheHeader
+    h;
+
+  cacheEntry
+    *entries;
+
+  uint64_t
+    count = 0,
+    size = 64,
+    offset = sizeof(cacheHeader),
+    pad = 0;
+
+  unsigned long int
+    m,
+    next,
+    maxM = (maxTaxa > 2) ? maxTaxa - 1 : 1;
+
+  mpz_t
+    value,
+    step;
+
+  boolean
+    success = TRUE;
+
+  sprintf(tmpName, "%s.tmp.%ld", fileName, (long)getpid());
+
+  f = fopen(tmpName, "wb");
+
+  if(!f)
+    return FALSE;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  h.limbBytes = sizeof(mp_limb_t);
+  h.byteOrder = CACHE_BYTE_ORDER;
+
+  entries = (cacheEntry *)malloc(sizeof(cacheEntry) * size);
+
+  mpz_init_set_ui(value, 1);
+  mpz_init(step);
+
+  success = fwrite(&h, sizeof(h), 1, f) == 1;
+
+  for(m = 1; success; m = next)
+    {
+      if(count == size)
+	{
+	  size *= 2;
+	  entries = (cacheEntry *)realloc(entries, sizeof(cacheEntry) * size);
+	}
+
+      entries[count].m      = m;
+      entries[count].offset = offset;
+      entries[count].limbs  = mpz_size(value);
+
+      success = fwrite(mpz_limbs_read(value), sizeof(mp_limb_t), mpz_size(value), f) == mpz_size(value);
+
+      offset += entries[count].limbs * sizeof(mp_limb_t);
+      count++;
+
+      if(m == maxM)
+	break;
+
+      next = (m < CACHE_DENSE) ? m + 1 : m + m / CACHE_STEP;
+      if(next > maxM)
+	next = maxM;
+
+      /* D(next) = D(m) * (2m + 1) * ... * (2next - 1) */
+
+      parallelOddProduct(step, 2 * m + 1, 2 * next - 1, (next - m > CACHE_DENSE) ? threads : 1);
+      mpz_mul(value, value, step);
+    }
+
+  h.count       = count;
+  h.tableOffset = (offset + sizeof(uint64_t) - 1) / sizeof(uint64_t) * sizeof(uint64_t);
+
+  if(success && h.tableOffset > offset)
+    success = fwrite(&pad, 1, h.tableOffset - offset, f) == h.tableOffset - offset;
+
+  if(success)
+    success = fwrite(entries, sizeof(cacheEntry), count, f) == count && 
+      fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1;
+
+  if(fclose(f) != 0)
+    success = FALSE;
+
+  if(success)
+    success = rename(tmpName, fileName) == 0;
+  else
+    remove(tmpName);
+
+  if(success)
+    printf("Wrote %lu double factorial checkpoints up to (%lu)!! to cache %s\n", (unsigned long)count, 2 * maxM - 1, fileName);
+
+  mpz_clear(value);
+  mpz_clear(step);
+  free(entries);
+
+  return success;
+#else
+  (void) fileName;
+  (void) maxTaxa;
+  (void) threads;
+
+  printf("The double factorial cache requires GMP 6 or later\n");
+
+  return FALSE;
+#endif
+}
+
+#endif
+
+static int compareDegrees(const void *a, const void *b)
+{
+  int 
+    x = *((const int *)a),
+    y = *((const int *)b);
+
+  return (x > y) - (x < y);
+}
+
+/* product over all polytomies recorded in h, the large degrees are run-length encoded first */
+
+static void histogramProduct(mpz_t r, degreeHistogram *h, int threads)
+{
+  degreePower
+    *powers = (degreePower *)malloc(sizeof(degreePower) * (DENSE_DEGREES + h->largeCount));
+
+  powerArray
+    a;
+
+  size_t
+    count = 0,
+    i,
+    j;
+
+  int
+    k;
+
+  for(k = 3; k < DENSE_DEGREES; k++)
+    if(h->dense[k] > 0)
+      {
+	powers[count].degree       = (unsigned long int)k;
+	powers[count].multiplicity = h->dense[k];
+	count++;
+      }
+
+  qsort(h->large, h->largeCount, sizeof(int), compareDegrees);
+
+  for(i = 0; i < h->largeCount; i = j)
+    {
+      for(j = i; j < h->largeCount && h->large[j] == h->large[i]; j++)
+	;
+
+      powers[count].degree       = (unsigned long int)h->large[i];
+      powers[count].multiplicity = (unsigned long int)(j - i);
+      count++;
+    }
+
+  a.powers = powers;
+  a.count  = count;
+
+  parallelProduct(r, powerArrayLeaf, (const void *)&a, count, threads);
+
+  free(powers);
+}
+
+/* 
+   optional persistent cache of exact constraint counts in the directory 
+   resultCacheDir, content-addressed by the degree multiset, which is all 
+   the count depends on. Labels, branch lengths, comments and the order of 
+   the children do not change the key, neither do the taxon names. The key 
+   is the list of (degree, multiplicity) pairs in increasing degree order, 
+   the file name is a 64-bit hash of it. Every file starts with the key, a 
+   hash collision is a miss. 
+
+   Layout: RESULT_MAGIC, RESULT_BYTE_ORDER and the number of pairs as 
+   uint64_t, the pairs and the count as mpz_out_raw() record. Files are 
+   written under a temporary name and renamed, concurrent writers of the 
+   same key thus write the same content.
+*/
+
+#define RESULT_MAGIC      "TCRES01"
+#define RESULT_BYTE_ORDER 0x0102030405060708ULL
+#define RESULT_PAIR_WORDS 2      /* a degree and its multiplicity */
+
+typedef struct
+{
+  uint64_t *words;
+  uint64_t  count;
+  uint64_t  hash;
+}
+  resultKey;
+
+static void histogramKey(degreeHistogram *h, resultKey *k)
+{
+  size_t
+    i,
+    j,
+    n = 0;
+
+  int
+    d;
+
+  uint64_t
+    x = 0xcbf29ce484222325ULL;
+
+  k->words = (uint64_t *)malloc(sizeof(uint64_t) * RESULT_PAIR_WORDS * (DENSE_DEGREES + h->largeCount));
+  assert(k->words);
+
+  for(d = 3; d < DENSE_DEGREES; d++)
+    if(h->dense[d] > 0)
+      {
+	k->words[n++] = (uint64_t)d;
+	k->words[n++] = (uint64_t)h->dense[d];
+      }
+
+  qsort(h->large, h->largeCount, sizeof(int), compareDegrees);
+
+  for(i = 0; i < h->largeCount; i = j)
+    {
+      for(j = i; j < h->largeCount && h->large[j] == h->large[i]; j++)
+	;
+
+      k->words[n++] = (uint64_t)h->large[i];
+      k->words[n++] = (uint64_t)(j - i);
+    }
+
+  /* FNV-1a over the words followed by the splitmix64 finalizer */
+
+  for(i = 0; i < n; i++)
+    x = (x ^ k->words[i]) * 0x100000001b3ULL;
+
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+
+  k->count = (uint64_t)n / RESULT_PAIR_WORDS;
+  k->hash  = x;
+}
+
+static boolean loadCachedResult(mpz_t r, const char *fileName, resultKey *k)
+{
+  FILE
+    *f = fopen(fileName, "rb");
+
+  char
+    magic[8];
+
+  uint64_t
+    order,
+    count,
+    *words;
+
+  size_t
+    keyWords = RESULT_PAIR_WORDS * (size_t)k->count;
+
+  boolean
+    found;
+
+  if(!f)
+    return FALSE;
+
+  found = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, RESULT_MAGIC, sizeof(RESULT_MAGIC)) == 0 &&
+    fread(&order, sizeof(uint64_t), 1, f) == 1 && order == RESULT_BYTE_ORDER &&
+    fread(&count, sizeof(uint64_t), 1, f) == 1 && count == k->count;
+
+  /* the pairs are only read once the header matched, a tree without polytomies has none */
+
+  if(found && keyWords > 0)
+    {
+      words = (uint64_t *)malloc(sizeof(uint64_t) * keyWords);
+      assert(words);
+
+      found = fread(words, sizeof(uint64_t), keyWords, f) == keyWords && memcmp(words, k->words, sizeof(uint64_t) * keyWords) == 0;
+
+      free(words);
+    }
+
+  found = found && mpz_inp_raw(r, f) > 0;
+
+  fclose(f);
+
+  return found;
+}
+
+static void storeCachedResult(mpz_t r, const char *fileName, resultKey *k)
+{
+  static unsigned long 
+    files = 0;
+
+  char
+    tmpName[2200];
+
+  FILE
+    *f;
+
+  uint64_t
+    order = RESULT_BYTE_ORDER;
+
+  boolean
+    written;
+
+  sprintf(tmpName, "%s.tmp.%ld.%lu", fileName, (long)getpid(), __sync_fetch_and_add(&files, 1));
+
+  if(!(f = fopen(tmpName, "wb")))
+    return;
+
+  written = fwrite(RESULT_MAGIC, 1, sizeof(RESULT_MAGIC), f) == sizeof(RESULT_MAGIC) &&
+    fwrite(&order, sizeof(uint64_t), 1, f) == 1 &&
+    fwrite(&(k->count), sizeof(uint64_t), 1, f) == 1 &&
+    fwrite(k->words, sizeof(uint64_t), RESULT_PAIR_WORDS * k->count, f) == RESULT_PAIR_WORDS * k->count &&
+    mpz_out_raw(f, r) > 0;
+
+  written = (fclose(f) == 0) && written;
+
+  if(!written || rename(tmpName, fileName) != 0)
+    unlink(tmpName);
+}
+
+/* histogramProduct() via the result cache, if there is one */
+
+static void cachedHistogramProduct(mpz_t r, degreeHistogram *h, int threads)
+{
+  resultKey
+    k;
+
+  char
+    fileName[2100];
+
+  if(resultCacheDir[0] == '\0')
+    {
+      histogramProduct(r, h, threads);
+      return;
+    }
+
+  histogramKey(h, &k);
+
+  sprintf(fileName, "%s/%016llx.tcr", resultCacheDir, (unsigned long long)k.hash);
+
+  if(!loadCachedResult(r, fileName, &k))
+    {
+      histogramProduct(r, h, threads);
+      storeCachedResult(r, fileName, &k);
+    }
+
+  free(k.words);
+}
+
+
+/* 
+   output of exact counts: dec and hex are written via mpz_out_str() into 
+   a large stdio buffer. GMP still builds the whole digit string first, 
+   dec with its subquadratic divide and conquer conversion, hex is a 
+   linear time conversion. raw writes mpz_out_raw() records and json one line per count to countFile, which is the 
+   original standard output while all messages then go to standard error.
+   The approximate leading digits are derived from the top limbs.
+*/
+
+#define FORMAT_DEC  0
+#define FORMAT_HEX  1
+#define FORMAT_RAW  2
+#define FORMAT_JSON 3
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+/* the output, the factored and the approximate counts are only used by the program */
+
+#ifndef TREECOUNTER_LIBRARY
+
+static FILE *countFile;
+
+/* 
+   the three leading decimal digits of integ >= 1000 and its decimal 
+   exponent, only if the mantissa obtained from the top limbs is too close 
+   to a digit boundary we divide by a power of ten to decide
+*/
+
+static long leadingDigits(mpz_t integ, int *digits)
+{
+  signed long int
+    e;
+
+  double
+    d = mpz_get_d_2exp(&e, integ);
+
+  long double
+    l = log10l((long double)d) + (long double)e * log10l(2.0L),
+    m;
+
+  long
+    exponent = (long)floorl(l);
+
+  size_t 
+    n;
+
+  mpz_t
+    p,
+    q;
+
+  m = powl(10.0L, l - (long double)exponent + 2.0L);
+  *digits = (int)floorl(m);
+
+  if(exponent >= 18 && m - (long double)*digits > 1.0e-6L && (long double)(*digits + 1) - m > 1.0e-6L && *digits >= 100 && *digits < 1000)
+    return exponent;
+
+  mpz_init(p);
+  mpz_init(q);
+
+  /* mpz_sizeinbase() is either exact or one too large */
+
+  n = mpz_sizeinbase(integ, 10);
+
+  mpz_ui_pow_ui(p, 10, (unsigned long int)(n - 3));
+  mpz_tdiv_q(q, integ, p);
+
+  if(mpz_cmp_ui(q, 100) < 0)
+    {
+      n--;
+      mpz_ui_pow_ui(p, 10, (unsigned long int)(n - 3));
+      mpz_tdiv_q(q, integ, p);
+    }
+
+  *digits = (int)mpz_get_ui(q);
+
+  mpz_clear(p);
+  mpz_clear(q);
+
+  return (long)(n - 1);
+}
+
+static void printJSONString(FILE *f, const char *s)
+{
+  fputc('"', f);
+
+  for(; *s; s++)
+    {
+      if(*s == '"' || *s == '\\')
+	fprintf(f, "\\%c", *s);
+      else if((unsigned char)*s < 0x20)
+	fprintf(f, "\\u%04x", (unsigned int)(unsigned char)*s);
+      else
+	fputc(*s, f);
+    }
+
+  fputc('"', f);
+}
+
+/* 
+   prints a count in the format selected via --format, kind is unrooted, 
+   rooted or constraint, max is the largest multifurcation of a constraint
+*/
+
+static void printCount(tree *tr, const char *what, const char *kind, long long taxa, int max, mpz_t integ)
+{
+  int 
+    digits;
+
+  long
+    exponent = 0;
+
+  switch(tr->format)
+    {
+    case FORMAT_RAW:
+      mpz_out_raw(countFile, integ);
+      return;
+    case FORMAT_JSON:
+      fprintf(countFile, "{\"kind\": \"%s\", ", kind);
+      if(max >= 0)
+	{
+	  fprintf(countFile, "\"file\": ");
+	  printJSONString(countFile, tr->fileName);
+	  fprintf(countFile, ", \"maxMultifurcation\": %d, ", max);
+	}
+      fprintf(countFile, "\"taxa\": %lld, \"count\": \"", taxa);
+      mpz_out_str(countFile, 10, integ);
+      fprintf(countFile, "\"}\n");
+      return;
+    case FORMAT_HEX:
+      printf("%s: 0x", what);
+      mpz_out_str(stdout, 16, integ);
+      printf("\n\n");
+      break;
+    default:
+      printf("%s: ", what);
+      mpz_out_str(stdout, 10, integ);
+      printf("\n\n");
+    }
+
+  if(mpz_cmp_ui(integ, 1000) >= 0)
+    {
+      exponent = leadingDigits(integ, &digits);
+      printf("Approximately %d.%02d times 10^%ld\n\n\n", digits / 100, digits % 100, exponent);
+    }
+}
+
+static void printConstraintCount(mpz_t integ, int max, tree *tr)
+{
+  printf("\n\nMaximum size unresolved multifurcation has %d taxa\n\n", max);
+
+  printCount(tr, "Number of unrooted binary trees under this constraint", "constraint", (long long)tr->ntips, max, integ);
+}
+
+/* 
+   counts below 2^128 are computed and printed without GMP, the products 
+   detect overflow and the callers then fall back to the arbitrary 
+   precision path
+*/
+
+#ifdef __SIZEOF_INT128__
+#define HAVE_INT128
+#endif
+
+#ifdef HAVE_INT128
+
+typedef unsigned __int128 uint128;
+
+static boolean multiply128(uint128 *r, uint128 f)
+{
+  if(f != 0 && *r > ~((uint128)0) / f)
+    return FALSE;
+
+  *r *= f;
+
+  return TRUE;
+}
+
+/* r = lo * (lo + 2) * ... * hi, FALSE on overflow */
+
+static boolean oddProduct128(uint128 *r, unsigned long int lo, unsigned long int hi)
+{
+  for(*r = 1; lo <= hi; lo += 2)
+    if(!multiply128(r, (uint128)lo))
+      return FALSE;
+
+  return TRUE;
+}
+
+/* product over all polytomies recorded in h, FALSE on overflow */
+
+static boolean histogramProduct128(uint128 *r, const degreeHistogram *h)
+{
+  uint128
+    term;
+
+  unsigned long int
+    j;
+
+  int
+    k;
+
+  /* (2 * DENSE_DEGREES - 3)!! does not fit anyway */
+
+  if(h->largeCount > 0)
+    return FALSE;
+
+  *r = 1;
+
+  for(k = 3; k < DENSE_DEGREES && k <= h->max; k++)
+    {
+      if(h->dense[k] == 0)
+	continue;
+
+      if(!oddProduct128(&term, 1, (unsigned long int)(2 * k - 3)))
+	return FALSE;
+
+      /* term >= 3, i.e., this loop overflows after at most 81 iterations */
+
+      for(j = 0; j < h->dense[k]; j++)
+	if(!multiply128(r, term))
+	  return FALSE;
+    }
+
+  return TRUE;
+}
+
+static char *uint128ToString(uint128 v, char *b, int base)
+{
+  char 
+    *p = &b[63];
+
+  *p = '\0';
+
+  do
+    {
+      *--p = "0123456789abcdef"[(int)(v % (uint128)base)];
+      v /= (uint128)base;
+    }
+  while(v > 0);
+
+  return p;
+}
+
+/* same layout as printCount(), raw records are written via GMP */
+
+static void printCount128(tree *tr, const char *what, const char *kind, long long taxa, int max, uint128 v)
+{
+  char 
+    b[64],
+    hex[64],
+    *d = uint128ToString(v, b, 10);
+
+  int 
+    n = (int)strlen(d);
+
+  uint64_t
+    words[2];
+
+  mpz_t
+    integ;
+
+  switch(tr->format)
+    {
+    case FORMAT_RAW:
+      words[0] = (uint64_t)v;
+      words[1] = (uint64_t)(v >> 64);
+      mpz_init(integ);
+      mpz_import(integ, 2, -1, sizeof(uint64_t), 0, 0, words);
+      printCount(tr, what, kind, taxa, max, integ);
+      mpz_clear(integ);
+      return;
+    case FORMAT_JSON:
+      fprintf(countFile, "{\"kind\": \"%s\", ", kind);
+      if(max >= 0)
+	{
+	  fprintf(countFile, "\"file\": ");
+	  printJSONString(countFile, tr->fileName);
+	  fprintf(countFile, ", \"maxMultifurcation\": %d, ", max);
+	}
+      fprintf(countFile, "\"taxa\": %lld, \"count\": \"%s\"}\n", taxa, d);
+      return;
+    case FORMAT_HEX:
+      printf("%s: 0x%s\n\n", what, uint128ToString(v, hex, 16));
+      break;
+    default:
+      printf("%s: %s\n\n", what, d);
+    }
+
+  if(n > 3)            
+    printf("Approximately %c.%c%c times 10^%d\n\n\n", d[0], d[1], d[2], n - 1);   
+}
+
+#endif
+
+
+
+/* 
+   factored mode (-F): every count is a product of odd integers and is kept 
+   as a vector of exponents of the odd primes up to 2n, the exponent of p 
+   in (2m - 1)!! = (2m)! / (2^m m!) follows from Legendre's formula as 
+   v_p((2m)!) - v_p(m!). Ratios such as constrained over unconstrained 
+   counts are then differences of exponent vectors in reduced form and 
+   bignums are only formed with -E via a balanced product of prime powers.
+*/
+
+typedef struct
+{
+  uint32_t *primes;
+  int64_t  *exponents;
+  size_t    count;
+}
+  primeExponents;
+
+typedef struct
+{
+  const uint32_t *primes;
+  const int64_t  *exponents;
+  size_t          count;
+}
+  primePowerArray;
+
+/* odd primes up to limit by an odd-only sieve of Eratosthenes */
+
+static void initPrimeExponents(primeExponents *f, unsigned long int limit)
+{
+  size_t
+    half = (size_t)(limit + 1) / 2,
+    size = 64,
+    i,
+    j;
+
+  unsigned char
+    *composite = (unsigned char *)calloc(half + 1, 1);
+
+  assert(composite);
+
+  f->count  = 0;
+  f->primes = (uint32_t *)malloc(sizeof(uint32_t) * size);
+
+  /* index i stands for 2i + 1 */
+
+  for(i = 1; i < half; i++)
+    {
+      if(composite[i])
+	continue;
+
+      if((size_t)(2 * i + 1) * (2 * i + 1) <= limit)
+	for(j = (2 * i + 1) * (2 * i + 1) / 2; j < half; j += 2 * i + 1)
+	  composite[j] = 1;
+
+      if(f->count == size)
+	{
+	  size *= 2;
+	  f->primes = (uint32_t *)realloc(f->primes, sizeof(uint32_t) * size);
+	}
+
+      f->primes[f->count++] = (uint32_t)(2 * i + 1);
+    }
+
+  f->exponents = (int64_t *)calloc(f->count + 1, sizeof(int64_t));
+
+  free(composite);
+}
+
+static void freePrimeExponents(primeExponents *f)
+{
+  free(f->primes);
+  free(f->exponents);
+}
+
+static int64_t legendre(unsigned long int n, unsigned long int p)
+{
+  int64_t
+    e = 0;
+
+  for(; n >= p; n /= p)
+    e += (int64_t)(n / p);
+
+  return e;
+}
+
+/* adds times * v_p((2m - 1)!!) for every odd prime p <= 2m - 1 */
+
+static void addOddDoubleFactorialExponents(primeExponents *f, unsigned long int m, int64_t times)
+{
+  size_t
+    i;
+
+  for(i = 0; i < f->count && f->primes[i] <= 2 * m - 1; i++)
+    f->exponents[i] += times * (legendre(2 * m, f->primes[i]) - legendre(m, f->primes[i]));
+}
+
+/* adds the factorization of the odd number x whose prime factors are all in f */
+
+static void addFactorExponents(primeExponents *f, unsigned long int x)
+{
+  size_t
+    i;
+
+  for(i = 0; i < f->count && x > 1; i++)
+    while(x % f->primes[i] == 0)
+      {
+	f->exponents[i]++;
+	x /= f->primes[i];
+      }
+}
+
+static void printFactorization(FILE *fp, const primeExponents *f, int sign)
+{
+  size_t
+    i;
+
+  boolean
+    first = TRUE;
+
+  for(i = 0; i < f->count; i++)
+    {
+      int64_t
+	e = sign * f->exponents[i];
+
+      if(e <= 0)
+	continue;
+
+      fprintf(fp, "%s%lu", first ? "" : " * ", (unsigned long)f->primes[i]);
+      if(e > 1)
+	fprintf(fp, "^%lld", (long long)e);
+
+      first = FALSE;
+    }
+
+  if(first)
+    fprintf(fp, "1");
+}
+
+static void printFactorizationJSON(FILE *fp, const primeExponents *f, int sign)
+{
+  size_t
+    i;
+
+  boolean
+    first = TRUE;
+
+  fprintf(fp, "[");
+
+  for(i = 0; i < f->count; i++)
+    if(sign * f->exponents[i] > 0)
+      {
+	fprintf(fp, "%s[%lu, %lld]", first ? "" : ", ", (unsigned long)f->primes[i], (long long)(sign * f->exponents[i]));
+	first = FALSE;
+      }
+
+  fprintf(fp, "]");
+}
+
+static long double factorizationLog10(const primeExponents *f)
+{
+  long double
+    l = 0.0L;
+
+  size_t
+    i;
+
+  for(i = 0; i < f->count; i++)
+    l += (long double)f->exponents[i] * log10l((long double)f->primes[i]);
+
+  return l;
+}
+
+/* product of primes[i]^exponents[i] for lo <= i < hi by binary splitting */
+
+static void primePowerProduct(mpz_t r, const primePowerArray *a, size_t lo, size_t hi)
+{
+  size_t 
+    mid;
+
+  mpz_t
+    right;
+
+  if(hi - lo <= 1)
+    {
+      if(hi == lo)
+	mpz_set_ui(r, 1);
+      else
+	mpz_ui_pow_ui(r, (unsigned long int)a->primes[lo], (unsigned long int)a->exponents[lo]);
+      return;
+    }
+
+  mid = lo + (hi - lo) / 2;
+
+  mpz_init(right);
+
+  primePowerProduct(r, a, lo, mid);
+  primePowerProduct(right, a, mid, hi);
+  mpz_mul(r, r, right);
+
+  mpz_clear(right);
+}
+
+static void primePowerLeaf(mpz_t r, const void *data, size_t leaf, size_t leaves)
+{
+  const primePowerArray
+    *a = (const primePowerArray *)data;
+
+  primePowerProduct(r, a, leaf * a->count / leaves, (leaf + 1) * a->count / leaves);
+}
+
+/* product of p^e over all positive (sign = 1) or negative (sign = -1) exponents */
+
+static void expandFactorization(mpz_t r, const primeExponents *f, int sign, int threads)
+{
+  primePowerArray
+    a;
+
+  uint32_t
+    *primes = (uint32_t *)malloc(sizeof(uint32_t) * (f->count + 1));
+
+  int64_t
+    *exponents = (int64_t *)malloc(sizeof(int64_t) * (f->count + 1));
+
+  size_t
+    i;
+
+  for(i = 0, a.count = 0; i < f->count; i++)
+    if(sign * f->exponents[i] > 0)
+      {
+	primes[a.count]    = f->primes[i];
+	exponents[a.count] = sign * f->exponents[i];
+	a.count++;
+      }
+
+  a.primes    = primes;
+  a.exponents = exponents;
+
+  parallelProduct(r, primePowerLeaf, (const void *)&a, a.count, threads);
+
+  free(primes);
+  free(exponents);
+}
+
+/* prints a factored count and, with -E, its expansion */
+
+static void printFactoredCount(tree *tr, const char *what, const char *kind, long long taxa, primeExponents *f)
+{
+  mpz_t
+    integ;
+
+  if(tr->format == FORMAT_JSON)
+    {
+      fprintf(countFile, "{\"kind\": \"%s\", \"taxa\": %lld, \"factors\": ", kind, taxa);
+      printFactorizationJSON(countFile, f, 1);
+      fprintf(countFile, "}\n");
+    }
+  else
+    {
+      printf("%s as prime factorization: ", what);
+      printFactorization(stdout, f, 1);
+      printf("\n\nlog10 of this number is approximately %.6Lf\n\n", factorizationLog10(f));
+    }
+
+  if(tr->expand)
+    {
+      mpz_init(integ);
+      expandFactorization(integ, f, 1, tr->threads);
+      printCount(tr, what, kind, taxa, -1, integ);
+      mpz_clear(integ);
+    }
+}
+
+/* 
+   the reduced ratio of the constrained count in f over the (2n - 5)!! 
+   unrooted trees for the same taxa, f is turned into the ratio
+*/
+
+static void printFactoredRatio(tree *tr, primeExponents *f)
+{
+  mpz_t
+    integ;
+
+  addOddDoubleFactorialExponents(f, (unsigned long int)(tr->ntips - 2), -1);
+
+  if(tr->format == FORMAT_JSON)
+    {
+      fprintf(countFile, "{\"kind\": \"ratio\", \"taxa\": %d, \"numerator\": ", tr->ntips);
+      printFactorizationJSON(countFile, f, 1);
+      fprintf(countFile, ", \"denominator\": ");
+      printFactorizationJSON(countFile, f, -1);
+      fprintf(countFile, "}\n");
+    }
+  else
+    {
+      printf("Ratio of the constrained to all unrooted binary trees for %d taxa: (", tr->ntips);
+      printFactorization(stdout, f, 1);
+      printf(") / (");
+      printFactorization(stdout, f, -1);
+      printf(")\n\nlog10 of this ratio is approximately %.6Lf\n\n", factorizationLog10(f));
+    }
+
+  if(tr->expand)
+    {
+      mpz_init(integ);
+      expandFactorization(integ, f, 1, tr->threads);
+      printCount(tr, "Numerator of the ratio", "numerator", (long long)tr->ntips, -1, integ);
+      expandFactorization(integ, f, -1, tr->threads);
+      printCount(tr, "Denominator of the ratio", "denominator", (long long)tr->ntips, -1, integ);
+      mpz_clear(integ);
+    }
+}
+
+
+/* 
+   approximate mode (-a): the natural logarithm of the number of trees is 
+   summed over the distinct polytomy degrees or computed directly for -n, 
+   time and memory are thus constant in the number of taxa. Every term 
+   carries a conservative bound on its rounding and truncation error and 
+   only the leading digits that agree at both ends of the resulting 
+   interval are printed. If compiled with HAVE_MPFR the interval is 
+   computed with directed rounding in MPFR instead, which certifies the 
+   leading digits for any number of taxa.
+*/
+
+#define STIRLING_MIN 1024
+
+#ifdef HAVE_MPFR
+#define APPROXIMATE_PRECISION 256
+#else
+/* 
+   without MPFR the sums are kept as unevaluated pairs hi + lo of long 
+   doubles, the products are split exactly via fmal() such that the 
+   rounding error is dominated by the logarithm of a mantissa in [0.5, 1)
+   and not by the magnitude of the sum, which is about 10^16 for n = 10^15 
+*/
+
+#define LN2_HI      0.693147180559945309428690474L
+#define LN2_LO     -1.1458352726798733325959671e-20L
+#define INV_LN10_HI 0.434294481903251827645479413L
+#define INV_LN10_LO 5.6495057519187047074325658e-21L
+
+typedef struct
+{
+  long double hi;
+  long double lo;
+}
+  ddReal;
+
+static ddReal ddAdd(ddReal a, ddReal b)
+{
+  ddReal
+    r;
+
+  long double
+    s = a.hi + b.hi,
+    v = s - a.hi,
+    e = (a.hi - (s - v)) + (b.hi - v) + a.lo + b.lo;
+
+  r.hi = s + e;
+  r.lo = e - (r.hi - s);
+
+  return r;
+}
+
+static ddReal ddMul(ddReal a, long double b)
+{
+  ddReal
+    r;
+
+  long double
+    p = a.hi * b,
+    e = fmal(a.hi, b, -p) + a.lo * b;
+
+  r.hi = p + e;
+  r.lo = e - (r.hi - p);
+
+  return r;
+}
+
+static ddReal ddValue(long double v)
+{
+  ddReal
+    r;
+
+  r.hi = v;
+  r.lo = 0.0L;
+
+  return r;
+}
+#endif
+
+typedef struct
+{
+#ifdef HAVE_MPFR
+  mpfr_t      lo;
+  mpfr_t      hi;
+#else
+  ddReal      sum;
+  long double err;
+#endif
+}
+  logAccumulator;
+
+/* log10 of the count lies in [exponent + lo, exponent + hi] */
+
+typedef struct
+{
+  long long   exponent;
+  long double lo;
+  long double hi;
+}
+  logInterval;
+
+#ifdef HAVE_MPFR
+
+static void initLogAccumulator(logAccumulator *a)
+{
+  mpfr_init2(a->lo, APPROXIMATE_PRECISION);
+  mpfr_init2(a->hi, APPROXIMATE_PRECISION);
+  mpfr_set_ui(a->lo, 0, MPFR_RNDN);
+  mpfr_set_ui(a->hi, 0, MPFR_RNDN);
+}
+
+/* ln((2m - 1)!!) = lngamma(2m + 1) - lngamma(m + 1) - m ln(2) rounded towards rnd */
+
+static void mpfrLogOddDoubleFactorial(mpfr_t r, unsigned long int m, mpfr_rnd_t rnd)
+{
+  mpfr_rnd_t
+    opposite = (rnd == MPFR_RNDD) ? MPFR_RNDU : MPFR_RNDD;
+
+  mpfr_t
+    a,
+    b;
+
+  mpfr_init2(a, APPROXIMATE_PRECISION);
+  mpfr_init2(b, APPROXIMATE_PRECISION);
+
+  mpfr_set_ui(a, 2 * m + 1, MPFR_RNDN);
+  mpfr_lngamma(r, a, rnd);
+
+  mpfr_set_ui(a, m + 1, MPFR_RNDN);
+  mpfr_lngamma(b, a, opposite);
+  mpfr_sub(r, r, b, rnd);
+
+  mpfr_const_log2(b, opposite);
+  mpfr_mul_ui(b, b, m, opposite);
+  mpfr_sub(r, r, b, rnd);
+
+  mpfr_clear(a);
+  mpfr_clear(b);
+}
+
+static void addLogOddDoubleFactorial(logAccumulator *a, unsigned long int m, unsigned long int count)
+{
+  mpfr_t
+    t;
+
+  mpfr_init2(t, APPROXIMATE_PRECISION);
+
+  mpfrLogOddDoubleFactorial(t, m, MPFR_RNDD);
+  mpfr_mul_ui(t, t, count, MPFR_RNDD);
+  mpfr_add(a->lo, a->lo, t, MPFR_RNDD);
+
+  mpfrLogOddDoubleFactorial(t, m, MPFR_RNDU);
+  mpfr_mul_ui(t, t, count, MPFR_RNDU);
+  mpfr_add(a->hi, a->hi, t, MPFR_RNDU);
+
+  mpfr_clear(t);
+}
+
+static void addLogFactor(logAccumulator *a, unsigned long int f)
+{
+  mpfr_t
+    t;
+
+  mpfr_init2(t, APPROXIMATE_PRECISION);
+
+  mpfr_log_ui(t, f, MPFR_RNDD);
+  mpfr_add(a->lo, a->lo, t, MPFR_RNDD);
+
+  mpfr_log_ui(t, f, MPFR_RNDU);
+  mpfr_add(a->hi, a->hi, t, MPFR_RNDU);
+
+  mpfr_clear(t);
+}
+
+/* converts the natural logarithm to log10 and releases the accumulator */
+
+static void logAccumulatorInterval(logAccumulator *a, logInterval *r)
+{
+  mpfr_t
+    ln10;
+
+  mpfr_init2(ln10, APPROXIMATE_PRECISION);
+
+  mpfr_log_ui(ln10, 10, MPFR_RNDU);
+  mpfr_div(a->lo, a->lo, ln10, MPFR_RNDD);
+
+  mpfr_log_ui(ln10, 10, MPFR_RNDD);
+  mpfr_div(a->hi, a->hi, ln10, MPFR_RNDU);
+
+  r->exponent = (long long)mpfr_get_si(a->lo, MPFR_RNDD);
+
+  mpfr_sub_si(a->lo, a->lo, (long)r->exponent, MPFR_RNDD);
+  mpfr_sub_si(a->hi, a->hi, (long)r->exponent, MPFR_RNDU);
+
+  r->lo = mpfr_get_ld(a->lo, MPFR_RNDD);
+  r->hi = mpfr_get_ld(a->hi, MPFR_RNDU);
+
+  mpfr_clear(ln10);
+  mpfr_clear(a->lo);
+  mpfr_clear(a->hi);
+}
+
+#else
+
+static void initLogAccumulator(logAccumulator *a)
+{
+  a->sum = ddValue(0.0L);
+  a->err = 0.0L;
+}
+
+/* 
+   ln((2m - 1)!!) and a bound on its absolute error, small m are summed 
+   directly, otherwise we use the Stirling series 
+   m (ln(2m) - 1) + ln(2) / 2 - 1 / (24m) + 7 / (2880m^3) 
+   whose truncation error is below 31 / (40320m^5), ln(2m) is evaluated 
+   as k ln(2) + ln(f) for 2m = f 2^k 
+*/
+
+static ddReal logOddDoubleFactorial(unsigned long int m, long double *err)
+{
+  ddReal 
+    ln2,
+    s = ddValue(0.0L);
+
+  long double
+    x = (long double)m,
+    f;
+
+  unsigned long int
+    i;
+
+  int 
+    k;
+
+  if(m < STIRLING_MIN)
+    {
+      for(i = 2; i <= m; i++)
+	s = ddAdd(s, ddValue(logl((long double)(2 * i - 1))));
+
+      *err = 2.0L * LDBL_EPSILON * (s.hi + 1.0L);
+
+      return s;
+    }
+
+  ln2.hi = LN2_HI;
+  ln2.lo = LN2_LO;
+
+  f = frexpl(2.0L * x, &k);
+
+  s = ddMul(ln2, x * (long double)k);
+  s = ddAdd(s, ddMul(ddValue(logl(f)), x));
+  s = ddAdd(s, ddValue(-x));
+  s = ddAdd(s, ddValue(0.5L * LN2_HI - 1.0L / (24.0L * x) + 7.0L / (2880.0L * x * x * x)));
+
+  *err = 2.0L * LDBL_EPSILON * (x + 1.0L) + 16.0L * LDBL_EPSILON * LDBL_EPSILON * s.hi + 31.0L / (40320.0L * x * x * x * x * x);
+
+  return s;
+}
+
+static void addLogOddDoubleFactorial(logAccumulator *a, unsigned long int m, unsigned long int count)
+{
+  long double
+    err;
+
+  ddReal
+    t = logOddDoubleFactorial(m, &err);
+
+  a->sum  = ddAdd(a->sum, ddMul(t, (long double)count));
+  a->err += (long double)count * err + 16.0L * LDBL_EPSILON * LDBL_EPSILON * a->sum.hi;
+}
+
+static void addLogFactor(logAccumulator *a, unsigned long int f)
+{
+  long double
+    t = logl((long double)f);
+
+  a->sum  = ddAdd(a->sum, ddValue(t));
+  a->err += 2.0L * LDBL_EPSILON * t + 16.0L * LDBL_EPSILON * LDBL_EPSILON * a->sum.hi;
+}
+
+static void logAccumulatorInterval(logAccumulator *a, logInterval *r)
+{
+  ddReal
+    l,
+    inv;
+
+  long double
+    err,
+    frac;
+
+  inv.hi = INV_LN10_HI;
+  inv.lo = INV_LN10_LO;
+
+  l = ddMul(inv, a->sum.hi);
+  l = ddAdd(l, ddValue(a->sum.lo * INV_LN10_HI));
+
+  err = (a->err + 16.0L * LDBL_EPSILON * LDBL_EPSILON * a->sum.hi) * INV_LN10_HI * (1.0L + 4.0L * LDBL_EPSILON);
+
+  r->exponent = (long long)floorl(l.hi);
+
+  frac  = (l.hi - (long double)r->exponent) + l.lo;
+  r->lo = frac - err;
+  r->hi = frac + err;
+}
+
+#endif
+
+/* 
+   prints the leading digits that are identical when rounding both ends of 
+   the interval, a count is at least 1 such that the lower end is clamped to 0
+*/
+
+static int certifiedDigits(logInterval *r, char *b, long long *exponent)
+{
+  long double
+    mLo,
+    mHi,
+    scale = 1.0L,
+    dLo = 0.0L,
+    dHi = 0.0L;
+
+  int 
+    digits;
+
+  if((long double)r->exponent + r->lo < 0.0L)
+    r->lo = (r->exponent == 0) ? 0.0L : -(long double)r->exponent;
+
+  if(r->lo >= 1.0L)
+    {
+      r->exponent++;
+      r->lo -= 1.0L;
+      r->hi -= 1.0L;
+    }
+
+  *exponent = r->exponent;
+
+  mLo = powl(10.0L, r->lo) * (1.0L - 8.0L * LDBL_EPSILON);
+  mHi = powl(10.0L, r->hi) * (1.0L + 8.0L * LDBL_EPSILON);
+
+  if(mLo < 1.0L && *exponent == 0)
+    mLo = 1.0L;
+
+  for(digits = 6; digits > 0; digits--)
+    {
+      scale = powl(10.0L, (long double)(digits - 1));
+      dLo = floorl(mLo * scale + 0.5L);
+      dHi = floorl(mHi * scale + 0.5L);
+
+      if(mLo >= 1.0L && mHi < 10.0L && dLo == dHi)
+	break;
+    }
+
+  if(digits == 0)
+    return 0;
+
+  /* rounding may carry into the next power of ten */
+
+  if(dLo == 10.0L * scale)
+    {
+      dLo = scale;
+      (*exponent)++;
+    }
+
+  sprintf(b, "%.0Lf", dLo);
+
+  return digits;
+}
+
+static void printApproximateCount(const char *what, logInterval *r)
+{
+  long long
+    exponent;
+
+  char 
+    b[32];
+
+  int 
+    digits = certifiedDigits(r, b, &exponent);
+
+  if(digits == 0)
+    {
+      printf("%s: between 10^%lld and 10^%lld\n\n", what, exponent + (long long)floorl(r->lo), exponent + (long long)ceill(r->hi));
+      return;
+    }
+
+  if(digits == 1)
+    printf("%s: approximately %c times 10^%lld\n\n", what, b[0], exponent);
+  else
+    printf("%s: approximately %c.%s times 10^%lld\n\n", what, b[0], &b[1], exponent);
+
+  printf("log10 of this number lies in %lld + [%.12Lf, %.12Lf]\n\n\n", r->exponent, r->lo, r->hi);
+}
+
+/* the same digits in scientific notation for tables */
+
+static void formatApproximateCount(logInterval *r, char *s)
+{
+  long long
+    exponent;
+
+  char 
+    b[32];
+
+  int 
+    digits = certifiedDigits(r, b, &exponent);
+
+  if(digits == 0)
+    sprintf(s, "1e%lld..1e%lld", exponent + (long long)floorl(r->lo), exponent + (long long)ceill(r->hi));
+  else if(digits == 1)
+    sprintf(s, "%ce%lld", b[0], exponent);
+  else
+    sprintf(s, "%c.%se%lld", b[0], &b[1], exponent);
+}
+
+static void approximateNumberOfTrees(tree *tr)
+{
+  logAccumulator
+    a;
+
+  logInterval
+    r;
+
+  char
+    what[256];
+
+  /* (2n - 5)!! = (2m - 1)!! for m = n - 2 */
+
+  initLogAccumulator(&a);
+  addLogOddDoubleFactorial(&a, (unsigned long int)(tr->numTaxa - 2), 1);
+  logAccumulatorInterval(&a, &r);
+
+  sprintf(what, "Number of unrooted binary trees for %lld taxa", tr->numTaxa);
+  printApproximateCount(what, &r);
+
+  initLogAccumulator(&a);
+  addLogOddDoubleFactorial(&a, (unsigned long int)(tr->numTaxa - 2), 1);
+  addLogFactor(&a, (unsigned long int)(2 * tr->numTaxa - 3));
+  logAccumulatorInterval(&a, &r);
+
+  sprintf(what, "Number of rooted binary trees for %lld taxa", tr->numTaxa);
+  printApproximateCount(what, &r);
+}
+
+/* 
+   the prime exponents of the count of a constraint tree, primes up to 2n 
+   cover the constrained and the unconstrained count 
+*/
+
+static void histogramExponents(primeExponents *f, degreeHistogram *h, tree *tr)
+{
+  size_t
+    i;
+
+  int
+    k;
+
+  initPrimeExponents(f, (unsigned long int)(2 * tr->ntips));
+
+  for(k = 3; k < DENSE_DEGREES; k++)
+    if(h->dense[k] > 0)
+      addOddDoubleFactorialExponents(f, (unsigned long int)(k - 1), (int64_t)h->dense[k]);
+
+  for(i = 0; i < h->largeCount; i++)
+    addOddDoubleFactorialExponents(f, (unsigned long int)(h->large[i] - 1), 1);
+}
+
+/* 
+   the certified log10 interval of the count of a constraint tree, a 
+   polytomy with k children contributes (2k - 3)!! = (2m - 1)!! for m = k - 1 
+*/
+
+static void histogramLogInterval(degreeHistogram *h, logInterval *r)
+{
+  logAccumulator
+    a;
+
+  size_t
+    i;
+
+  int
+    k;
+
+  initLogAccumulator(&a);
+
+  for(k = 3; k < DENSE_DEGREES; k++)
+    if(h->dense[k] > 0)
+      addLogOddDoubleFactorial(&a, (unsigned long int)(k - 1), h->dense[k]);
+
+  for(i = 0; i < h->largeCount; i++)
+    addLogOddDoubleFactorial(&a, (unsigned long int)(h->large[i] - 1), 1);
+
+  logAccumulatorInterval(&a, r);
+}
+
+/* the column names of the rows of -b and of several files, only for the tabular formats */
+
+static void printRowHeader(tree *tr)
+{
+  if(tr->format == FORMAT_DEC || tr->format == FORMAT_HEX)
+    fprintf(tr->rowFile, "%s%staxa\tmaxMultifurcation\t%s%s\n", tr->multiFile ? "file\t" : "", tr->batch ? "tree\t" : "", tr->factored ? "factors" : "count", tr->unique ? "\tcopies" : "");
+}
+
+/* 
+   one row per tree of a collection or per file: the file name, the tree 
+   number, the number of taxa, the largest multifurcation and the count in 
+   the selected format 
+*/
+
+static void printHistogramRow(degreeHistogram *h, tree *tr)
+{
+  FILE
+    *out = tr->rowFile;
+
+  mpz_t 
+    integ;
+
+  char
+    b[96];
+
+  if(tr->format == FORMAT_JSON)
+    {
+      fprintf(out, "{");
+      if(tr->multiFile)
+	{
+	  fprintf(out, "\"file\": ");
+	  printJSONString(out, tr->fileName);
+	  fprintf(out, ", ");
+	}
+      if(tr->batch)
+	fprintf(out, "\"index\": %lld, ", tr->treeIndex);
+      fprintf(out, "\"taxa\": %d, \"maxMultifurcation\": %d, ", tr->ntips, h->max);
+    }
+  else if(tr->format != FORMAT_RAW)
+    {
+      if(tr->multiFile)
+	fprintf(out, "%s\t", tr->fileName);
+      if(tr->batch)
+	fprintf(out, "%lld\t", tr->treeIndex);
+      fprintf(out, "%d\t%d\t", tr->ntips, h->max);
+    }
+
+  if(tr->factored)
+    {
+      primeExponents
+	f;
+
+      histogramExponents(&f, h, tr);
+
+      if(tr->format == FORMAT_JSON)
+	{
+	  fprintf(out, "\"factors\": ");
+	  printFactorizationJSON(out, &f, 1);
+	  fprintf(out, "}\n");
+	}
+      else
+	{
+	  printFactorization(out, &f, 1);
+	  fprintf(out, "\n");
+	}
+
+      freePrimeExponents(&f);
+
+      return;
+    }
+
+  if(tr->approximate)
+    {
+      logInterval
+	r;
+
+      histogramLogInterval(h, &r);
+      formatApproximateCount(&r, b);
+
+      fprintf(out, "%s\n", b);
+
+      return;
+    }
+
+#ifdef HAVE_INT128
+  {
+    uint128
+      v;
+
+    if(tr->format != FORMAT_RAW && histogramProduct128(&v, h))
+      {
+	if(tr->format == FORMAT_JSON)
+	  fprintf(out, "\"count\": \"%s\"}\n", uint128ToString(v, b, 10));
+	else if(tr->format == FORMAT_HEX)
+	  fprintf(out, "0x%s\n", uint128ToString(v, b, 16));
+	else
+	  fprintf(out, "%s\n", uint128ToString(v, b, 10));
+	return;
+      }
+  }
+#endif
+
+  mpz_init(integ);
+
+  cachedHistogramProduct(integ, h, tr->threads);
+
+  switch(tr->format)
+    {
+    case FORMAT_RAW:
+      mpz_out_raw(out, integ);
+      break;
+    case FORMAT_JSON:
+      fprintf(out, "\"count\": \"");
+      mpz_out_str(out, 10, integ);
+      fprintf(out, "\"}\n");
+      break;
+    case FORMAT_HEX:
+      fprintf(out, "0x");
+      mpz_out_str(out, 16, integ);
+      fprintf(out, "\n");
+      break;
+    default:
+      mpz_out_str(out, 10, integ);
+      fprintf(out, "\n");
+    }
+
+  mpz_clear(integ);
+}
+
+/* prints the exact or, with -a, the approximate count of a constraint tree from its degree histogram */
+
+static void printHistogramCount(degreeHistogram *h, tree *tr)
+{
+  mpz_t 
+    integ;
+
+  if(tr->batch || tr->multiFile)
+    {
+      printHistogramRow(h, tr);
+      return;
+    }
+
+  if(tr->factored)
+    {
+      primeExponents
+	f;
+
+      histogramExponents(&f, h, tr);
+
+      printf("\n\nMaximum size unresolved multifurcation has %d taxa\n\n", h->max);
+      printFactoredCount(tr, "Number of unrooted binary trees under this constraint", "constraint", (long long)tr->ntips, &f);
+      printFactoredRatio(tr, &f);
+
+      freePrimeExponents(&f);
+
+      return;
+    }
+
+  if(tr->approximate)
+    {
+      logInterval
+	r;
+
+      histogramLogInterval(h, &r);
+
+      printf("\n\nMaximum size unresolved multifurcation has %d taxa\n\n", h->max);
+      printApproximateCount("Number of unrooted binary trees under this constraint", &r);
+
+      return;
+    }
+
+#ifdef HAVE_INT128
+  {
+    uint128
+      v;
+
+    if(histogramProduct128(&v, h))
+      {
+	printf("\n\nMaximum size unresolved multifurcation has %d taxa\n\n", h->max);
+	printCount128(tr, "Number of unrooted binary trees under this constraint", "constraint", (long long)tr->ntips, h->max, v);
+	return;
+      }
+  }
+#endif
+
+  mpz_init(integ);
+
+  cachedHistogramProduct(integ, h, tr->threads);
+
+  printConstraintCount(integ, h->max, tr);
+
+  mpz_clear(integ);
+}
+
+#endif
+
+
+static boolean treeReadLenMULT (treeReader *rd, tree *tr)
+{
+  topology
+    *t = &(tr->topo);
+
+  uint32_t
+    i,
+    c,
+    root;
+
+  int
+    degree;
+
+  degreeHistogram
+    *histogram;
+
+  /* the hash table, the topology and the frames are reused for the next tree of a collection */
+
+  if(tr->nameHash == (stringHashtable *)NULL)
+    {
+      tr->nameHash    = initStringHashTable(1024);
+
+      t->size         = 1024;
+      t->parent       = (uint32_t *)malloc(t->size * sizeof(uint32_t));
+      t->firstChild   = (uint32_t *)malloc(t->size * sizeof(uint32_t));
+      t->sibling      = (uint32_t *)malloc(t->size * sizeof(uint32_t));
+      t->taxon        = (uint32_t *)malloc(t->size * sizeof(uint32_t));
+
+      tr->frameSize   = 1024;
+      tr->frames      = (parseFrame *)malloc(tr->frameSize * sizeof(parseFrame));
+    }
+  else
+    clearStringHashTable(tr->nameHash);
+
+  t->nodes        = 0;
+  tr->ntips       = 0;
+  tr->rooted      = FALSE;
+ 
+  if(!readTopology(rd, tr))
+    return FALSE;
+
+  tr->mxtips = tr->ntips;
+
+  histogram = treeHistogram(tr);
+
+  /* 
+     a root with a single child is just a unary edge, the root rule 
+     applies to the first node below it that has more than one child 
+  */
+
+  root = 0;
+
+  while(t->firstChild[root] != NO_NODE && t->sibling[t->firstChild[root]] == NO_NODE)
+    root = t->firstChild[root];
+
+  for(i = 0; i < t->nodes; i++)
+    {
+      if(t->firstChild[i] == NO_NODE)
+	continue;
+
+      for(degree = 0, c = t->firstChild[i]; c != NO_NODE; c = t->sibling[c])
+	degree++;
+
+      /* 
+	 the root of an unrooted tree with k children resolves like an 
+	 inner node with k - 1 children, a bifurcating root vanishes 
+      */
+
+      if(i == root)
+	{
+	  if(degree == 2)
+	    tr->rooted = TRUE;
+	  degree--;
+	}
+
+      addDegree(histogram, degree, 1);
+    }
+ 
+  return TRUE; 
+}
+
+
+/*
+   deduplication of the trees of a collection, e.g., of a posterior sample.
+   The taxa of all trees are interned into one table, i.e., a label has the
+   same taxon id 1, 2, ... in every tree of the collection. The canonical
+   form of a tree is the unrooted topology hanging from the taxon with the
+   smallest id, with a bifurcating root and all unary nodes suppressed and 
+   the children of every node ordered by the smallest taxon id below them. It is written
+   as a sequence of words in pre-order: the smallest id, then for every
+   node either its taxon id or CANONICAL_OPEN, the children and
+   CANONICAL_CLOSE. Two trees thus have the same form iff they have the
+   same unrooted topology, independent of the order of the children, the
+   rooting, branch lengths and comments.
+
+   The children are ordered by one bucket sort over the taxon ids of the
+   tree, which are radix sorted, instead of sorting every node, i.e., the 
+   form is computed in time linear in the size of the tree. The distinct forms are
+   stored in an open addressing table, a hash match is only accepted if
+   the words are identical.
+*/
+
+#define CANONICAL_OPEN  ((uint32_t)0)
+#define CANONICAL_CLOSE NO_NODE
+
+typedef struct
+{
+  uint64_t         hash;
+  size_t           offset;
+  size_t           length;
+  long long        copies;
+  char            *row;
+  size_t           rowLength;
+}
+  topologyEntry;
+
+typedef struct topologySet
+{
+  stringHashtable *taxa;
+  uint32_t        *taxonId;
+  uint32_t        *sortedTaxa;
+  uint32_t        *radix;
+  uint32_t         taxonSize;
+
+  /* the rerooted tree, indexed by the nodes of tr->topo */
+
+  uint32_t        *parent;
+  uint32_t        *firstChild;
+  uint32_t        *sibling;
+  uint32_t        *minTaxon;
+  uint32_t        *order;
+  uint32_t        *next;
+  uint32_t         nodeSize;
+  uint32_t        *bucket;
+  uint32_t         bucketSize;
+
+  uint32_t        *key;
+  size_t           keyLength;
+  size_t           keySize;
+  uint64_t         hash;
+
+  topologyEntry   *entry;
+  int              entries;
+  int              entrySize;
+  int             *table;
+  int              tableSize;
+  uint32_t        *words;
+  size_t           wordsUsed;
+  size_t           wordsSize;
+}
+  topologySet;
+
+static void resetTopologyTable(topologySet *s)
+{
+  int
+    i;
+
+  for(i = 0; i < s->tableSize; i++)
+    s->table[i] = -1;
+}
+
+/* forgets the taxa and the topologies for the next collection, keeps all buffers */
+
+static void clearTopologySet(topologySet *s)
+{
+  int
+    i;
+
+  for(i = 0; i < s->entries; i++)
+    free(s->entry[i].row);
+
+  clearStringHashTable(s->taxa);
+  resetTopologyTable(s);
+
+  s->entries   = 0;
+  s->wordsUsed = 0;
+}
+
+static void freeTopologySet(topologySet *s)
+{
+  clearTopologySet(s);
+
+  freeStringHashTable(s->taxa);
+  free(s->taxonId);
+  free(s->sortedTaxa);
+  free(s->radix);
+  free(s->parent);
+  free(s->firstChild);
+  free(s->sibling);
+  free(s->minTaxon);
+  free(s->order);
+  free(s->next);
+  free(s->bucket);
+  free(s->key);
+  free(s->entry);
+  free(s->table);
+  free(s->words);
+  free(s);
+}
+
+#ifndef TREECOUNTER_LIBRARY
+
+static topologySet *initTopologySet(void)
+{
+  topologySet
+    *s = (topologySet *)calloc(1, sizeof(topologySet));
+
+  assert(s);
+
+  s->taxa       = initStringHashTable(1024);
+
+  s->entrySize  = 1024;
+  s->entry      = (topologyEntry *)malloc(s->entrySize * sizeof(topologyEntry));
+  s->tableSize  = 2 * s->entrySize;
+  s->table      = (int *)malloc(s->tableSize * sizeof(int));
+  s->wordsSize  = 1 << 16;
+  s->words      = (uint32_t *)malloc(s->wordsSize * sizeof(uint32_t));
+
+  assert(s->entry && s->table && s->words);
+
+  resetTopologyTable(s);
+
+  return s;
+}
+
+static uint32_t *growNodeArray(uint32_t *a, uint32_t size)
+{
+  a = (uint32_t *)realloc(a, size * sizeof(uint32_t));
+  assert(a);
+
+  return a;
+}
+
+/* the scratch arrays for a tree with nodes nodes and ntips taxa, taxa bounds the collection ids */
+
+static void growTopologySet(topologySet *s, uint32_t nodes, int ntips, uint32_t taxa)
+{
+  uint32_t
+    i;
+
+  if(s->nodeSize < nodes)
+    {
+      s->nodeSize   = 2 * nodes;
+      s->parent     = growNodeArray(s->parent, s->nodeSize);
+      s->firstChild = growNodeArray(s->firstChild, s->nodeSize);
+      s->sibling    = growNodeArray(s->sibling, s->nodeSize);
+      s->minTaxon   = growNodeArray(s->minTaxon, s->nodeSize);
+      s->order      = growNodeArray(s->order, s->nodeSize);
+      s->next       = growNodeArray(s->next, s->nodeSize);
+
+      s->keySize    = 2 * (size_t)s->nodeSize + 2;
+      s->key        = (uint32_t *)realloc(s->key, s->keySize * sizeof(uint32_t));
+      assert(s->key);
+    }
+
+  if(s->taxonSize <= (uint32_t)ntips)
+    {
+      s->taxonSize  = 2 * (uint32_t)ntips + 1;
+      s->taxonId    = growNodeArray(s->taxonId, s->taxonSize);
+      s->sortedTaxa = growNodeArray(s->sortedTaxa, s->taxonSize);
+      s->radix      = growNodeArray(s->radix, s->taxonSize);
+    }
+
+  if(s->bucketSize <= taxa)
+    {
+      i             = s->bucketSize;
+      s->bucketSize = 2 * taxa + 1;
+      s->bucket     = growNodeArray(s->bucket, s->bucketSize);
+
+      for(; i < s->bucketSize; i++)
+	s->bucket[i] = NO_NODE;
+    }
+}
+
+/* LSD radix sort of n taxon ids below max, one pass per byte that occurs in max */
+
+static void sortTaxonIds(uint32_t *a, uint32_t *tmp, uint32_t n, uint32_t max)
+{
+  uint32_t
+    count[256],
+    *swap,
+    *in = a,
+    i,
+    sum,
+    c;
+
+  int
+    shift;
+
+  for(shift = 0; shift < 32 && (max >> shift) > 0; shift += 8)
+    {
+      memset(count, 0, sizeof(count));
+
+      for(i = 0; i < n; i++)
+	count[(in[i] >> shift) & 255]++;
+
+      for(i = 0, sum = 0; i < 256; i++)
+	{
+	  c        = count[i];
+	  count[i] = sum;
+	  sum     += c;
+	}
+
+      for(i = 0; i < n; i++)
+	tmp[count[(in[i] >> shift) & 255]++] = in[i];
+
+      swap = in;
+      in   = tmp;
+      tmp  = swap;
+    }
+
+  if(in != a)
+    memcpy(a, in, n * sizeof(uint32_t));
+}
+
+/* the first node at or below v that is not a unary inner node */
+
+static uint32_t skipUnary(topology *t, uint32_t v)
+{
+  while(t->firstChild[v] != NO_NODE && t->sibling[t->firstChild[v]] == NO_NODE)
+    v = t->firstChild[v];
+
+  return v;
+}
+
+/*
+   the neighbour of v towards the root, unary nodes are skipped and the two
+   children of a bifurcating root are neighbours of each other
+*/
+
+static uint32_t upperNeighbour(topology *t, uint32_t v, uint32_t root, boolean suppressRoot)
+{
+  uint32_t
+    u = v,
+    p = t->parent[v];
+
+  while(p != NO_NODE && t->sibling[t->firstChild[p]] == NO_NODE)
+    {
+      u = p;
+      p = t->parent[p];
+    }
+
+  if(p == root && suppressRoot)
+    p = skipUnary(t, (t->firstChild[root] == u) ? t->sibling[u] : t->firstChild[root]);
+
+  return p;
+}
+
+/* the canonical form of the tree in tr->topo in s->key, its hash in s->hash */
+
+static void canonicalTopology(tree *tr, topologySet *s)
+{
+  topology
+    *t = &(tr->topo);
+
+  stringHashtable
+    *h = tr->nameHash;
+
+  uint32_t
+    *key,
+    i,
+    m,
+    p,
+    v,
+    w,
+    c,
+    top,
+    root,
+    least = NO_NODE,
+    stack = 0;
+
+  boolean
+    suppressRoot;
+
+  size_t
+    n = 0;
+
+  uint64_t
+    x = 0xcbf29ce484222325ULL;
+
+  int
+    k;
+
+  /* the taxa of a tree are interned in order, taxon k is entry k - 1 of tr->nameHash */
+
+  growTopologySet(s, t->nodes, tr->ntips, s->taxa->entries + (uint32_t)tr->ntips);
+
+  for(k = 1; k <= tr->ntips; k++)
+    {
+      s->taxonId[k]        = (uint32_t)internWord(hashWord(h, k - 1), h->entry[k - 1].length, s->taxa, (int)s->taxa->entries + 1);
+      s->sortedTaxa[k - 1] = s->taxonId[k];
+    }
+
+  sortTaxonIds(s->sortedTaxa, s->radix, (uint32_t)tr->ntips, s->taxa->entries);
+
+  for(v = 0; v < t->nodes; v++)
+    if(t->taxon[v] != 0 && (least == NO_NODE || s->taxonId[t->taxon[v]] < s->taxonId[t->taxon[least]]))
+      least = v;
+
+  /* a root with a single child is a unary edge as in treeReadLenMULT() */
+
+  root = skipUnary(t, 0);
+
+  suppressRoot = (t->firstChild[root] != NO_NODE && t->sibling[t->sibling[t->firstChild[root]]] == NO_NODE);
+
+  /* reroot at the neighbour of the least taxon, s->next is the stack of the traversal */
+
+  top = upperNeighbour(t, least, root, suppressRoot);
+
+  s->parent[top]   = least;
+  s->next[stack++] = top;
+
+  for(m = 0; stack > 0; )
+    {
+      v = s->next[--stack];
+
+      s->order[m++]    = v;
+      s->firstChild[v] = NO_NODE;
+      s->minTaxon[v]   = (t->taxon[v] != 0) ? s->taxonId[t->taxon[v]] : NO_NODE;
+
+      w = upperNeighbour(t, v, root, suppressRoot);
+
+      if(w != NO_NODE && w != s->parent[v])
+	{
+	  s->parent[w] = v;
+	  s->next[stack++] = w;
+	}
+
+      for(w = t->firstChild[v]; w != NO_NODE; w = t->sibling[w])
+	{
+	  c = skipUnary(t, w);
+
+	  if(c != s->parent[v])
+	    {
+	      s->parent[c] = v;
+	      s->next[stack++] = c;
+	    }
+	}
+    }
+
+  /* children before parents */
+
+  for(i = m - 1; i > 0; i--)
+    {
+      v = s->order[i];
+      p = s->parent[v];
+
+      if(s->minTaxon[v] < s->minTaxon[p])
+	s->minTaxon[p] = s->minTaxon[v];
+    }
+
+  /*
+     bucket sort of all nodes by their least taxon, siblings have different
+     least taxa and inserting them in decreasing order at the front of the
+     child lists yields increasing order. Only the buckets of the taxa of 
+     this tree are visited.
+  */
+
+  for(i = 1; i < m; i++)
+    {
+      v = s->order[i];
+
+      s->next[v] = s->bucket[s->minTaxon[v]];
+      s->bucket[s->minTaxon[v]] = v;
+    }
+
+  for(k = tr->ntips; k > 0; k--)
+    {
+      w = s->sortedTaxa[k - 1];
+
+      for(v = s->bucket[w]; v != NO_NODE; v = s->next[v])
+	{
+	  p = s->parent[v];
+
+	  s->sibling[v]    = s->firstChild[p];
+	  s->firstChild[p] = v;
+	}
+
+      s->bucket[w] = NO_NODE;
+    }
+
+  /* pre-order walk of the rerooted tree */
+
+  key = s->key;
+
+  key[n++] = s->taxonId[t->taxon[least]];
+
+  v = top;
+
+  for(;;)
+    {
+      if(t->taxon[v] != 0)
+	key[n++] = s->taxonId[t->taxon[v]];
+      else
+	{
+	  key[n++] = CANONICAL_OPEN;
+
+	  if(s->firstChild[v] != NO_NODE)
+	    {
+	      v = s->firstChild[v];
+	      continue;
+	    }
+
+	  key[n++] = CANONICAL_CLOSE;
+	}
+
+      while(v != top && s->sibling[v] == NO_NODE)
+	{
+	  v = s->parent[v];
+	  key[n++] = CANONICAL_CLOSE;
+	}
+
+      if(v == top)
+	break;
+
+      v = s->sibling[v];
+    }
+
+  /* FNV-1a followed by the splitmix64 finalizer as for the result cache keys */
+
+  for(i = 0; i < n; i++)
+    x = (x ^ key[i]) * 0x100000001b3ULL;
+
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+
+  s->keyLength = n;
+  s->hash      = x;
+}
+
+static void growTopologyTable(topologySet *s)
+{
+  int
+    i,
+    position,
+    mask;
+
+  s->tableSize *= 2;
+  s->table = (int *)realloc(s->table, s->tableSize * sizeof(int));
+  assert(s->table);
+
+  resetTopologyTable(s);
+
+  mask = s->tableSize - 1;
+
+  for(i = 0; i < s->entries; i++)
+    {
+      for(position = (int)(s->entry[i].hash & (uint64_t)mask); s->table[position] != -1; position = (position + 1) & mask)
+	;
+      s->table[position] = i;
+    }
+}
+
+/* looks up the canonical form in s->key and inserts it if it is new, *found tells if it was there already */
+
+static topologyEntry *findTopology(topologySet *s, boolean *found)
+{
+  topologyEntry
+    *e;
+
+  int
+    mask = s->tableSize - 1,
+    position,
+    i;
+
+  for(position = (int)(s->hash & (uint64_t)mask); (i = s->table[position]) != -1; position = (position + 1) & mask)
+    {
+      e = &(s->entry[i]);
+
+      if(e->hash == s->hash && e->length == s->keyLength && memcmp(&(s->words[e->offset]), s->key, s->keyLength * sizeof(uint32_t)) == 0)
+	{
+	  *found = TRUE;
+	  return e;
+	}
+    }
+
+  if(s->entries == s->entrySize)
+    {
+      s->entrySize *= 2;
+      s->entry = (topologyEntry *)realloc(s->entry, s->entrySize * sizeof(topologyEntry));
+      assert(s->entry);
+    }
+
+  while(s->wordsUsed + s->keyLength > s->wordsSize)
+    {
+      s->wordsSize *= 2;
+      s->words = (uint32_t *)realloc(s->words, s->wordsSize * sizeof(uint32_t));
+      assert(s->words);
+    }
+
+  i = s->entries++;
+  e = &(s->entry[i]);
+
+  e->hash      = s->hash;
+  e->offset    = s->wordsUsed;
+  e->length    = s->keyLength;
+  e->copies    = 1;
+  e->row       = (char *)NULL;
+  e->rowLength = 0;
+
+  memcpy(&(s->words[s->wordsUsed]), s->key, s->keyLength * sizeof(uint32_t));
+  s->wordsUsed += s->keyLength;
+
+  s->table[position] = i;
+
+  if(2 * s->entries > s->tableSize)
+    growTopologyTable(s);
+
+  *found = FALSE;
+
+  return e;
+}
+
+#endif
+
+
+/* 
+   structural index for the count-only engine: the scanners below report 
+   the offsets of all bytes of a block that may carry structure in a Newick 
+   string, i.e., ( ) , : ; [ ] and quotes. Everything in between is either a
+   label, a branch length, a comment or white space and is only looked at 
+   when the counter needs to know if a taxon label is present. The scanners 
+   do not know about quoting or comments, the counter resolves this while 
+   consuming the index.
+*/
+
+#define STRUCTURAL_BLOCK_SIZE (1 << 16)
+
+/* 
+   the stream counter starts with small blocks that grow up to the full 
+   size, the index of a short tree in a collection thus does not cover 
+   much of the following trees which are scanned again
+*/
+
+#define STRUCTURAL_FIRST_BLOCK_SIZE (1 << 10)
+
+typedef size_t (*structuralScanner)(const char *buffer, size_t length, uint32_t *index);
+
+static boolean structuralChar(int ch)
+{
+  switch (ch) 
+    {
+    case '(':   
+    case ')':  
+    case ',':   
+    case ':':  
+    case ';':
+    case '[':
+    case ']':
+    case '\'':
+      return TRUE;
+    default:
+      break;
+    }
+  return FALSE;
+}
+
+static size_t scanStructuralScalar(const char *buffer, size_t length, uint32_t *index)
+{
+  size_t 
+    i,
+    n = 0;
+
+  for(i = 0; i < length; i++)
+    if(structuralChar((unsigned char)buffer[i]))
+      index[n++] = (uint32_t)i;
+
+  return n;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+
+#define SIMD_SCANNERS
+
+/* 
+   AVX2 version, classifies 64 bytes per iteration via two nibble lookups: the 
+   low nibble table marks the groups a low nibble occurs in, the high nibble 
+   table the group of the high nibble, group 1 = ( ) , ' group 2 = : ; and 
+   group 4 = [ ]
+*/
+
+__attribute__((target("avx2")))
+static uint32_t structuralMaskAVX2(__m256i v)
+{
+  const __m256i 
+    lowTable  = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 2, 6, 1, 4, 0, 0,
+				 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 2, 6, 1, 4, 0, 0),
+    highTable = _mm256_setr_epi8(0, 0, 1, 2, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+				 0, 0, 1, 2, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0),
+    nibble    = _mm256_set1_epi8(0x0f);
+
+  __m256i
+    low  = _mm256_shuffle_epi8(lowTable, _mm256_and_si256(v, nibble)),
+    high = _mm256_shuffle_epi8(highTable, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)),
+    none = _mm256_cmpeq_epi8(_mm256_and_si256(low, high), _mm256_setzero_si256());
+
+  return ~(uint32_t)_mm256_movemask_epi8(none);
+}
+
+__attribute__((target("avx2")))
+static size_t scanStructuralAVX2(const char *buffer, size_t length, uint32_t *index)
+{
+  size_t 
+    i,
+    n = 0;
+
+  uint64_t 
+    mask;
+
+  for(i = 0; i + 64 <= length; i += 64)
+    {
+      mask = (uint64_t)structuralMaskAVX2(_mm256_loadu_si256((const __m256i *)(buffer + i))) |
+	((uint64_t)structuralMaskAVX2(_mm256_loadu_si256((const __m256i *)(buffer + i + 32))) << 32);
+
+      while(mask)
+	{
+	  index[n++] = (uint32_t)(i + __builtin_ctzll(mask));
+	  mask &= mask - 1;
+	}
+    }
+
+  for(; i < length; i++)
+    if(structuralChar((unsigned char)buffer[i]))
+      index[n++] = (uint32_t)i;
+
+  return n;
+}
+
+/* SSE4.2 version, PCMPESTRM with the eight structural characters as set, 16 bytes at a time */
+
+__attribute__((target("sse4.2")))
+static size_t scanStructuralSSE42(const char *buffer, size_t length, uint32_t *index)
+{
+  const __m128i 
+    set = _mm_setr_epi8('(', ')', ',', ':', ';', '[', ']', '\'', 0, 0, 0, 0, 0, 0, 0, 0);
+
+  size_t 
+    i,
+    n = 0;
+
+  uint32_t 
+    mask;
+
+  for(i = 0; i + 16 <= length; i += 16)
+    {
+      mask = (uint32_t)_mm_cvtsi128_si32(_mm_cmpestrm(set, 8, _mm_loadu_si128((const __m128i *)(buffer + i)), 16, 
+						      _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK));
+
+      while(mask)
+	{
+	  index[n++] = (uint32_t)(i + __builtin_ctz(mask));
+	  mask &= mask - 1;
+	}
+    }
+
+  for(; i < length; i++)
+    if(structuralChar((unsigned char)buffer[i]))
+      index[n++] = (uint32_t)i;
+
+  return n;
+}
+
+#endif
+
+static structuralScanner selectStructuralScanner(void)
+{
+#ifdef SIMD_SCANNERS
+  __builtin_cpu_init();
+
+  if(__builtin_cpu_supports("avx2"))
+    return scanStructuralAVX2;
+
+  if(__builtin_cpu_supports("sse4.2"))
+    return scanStructuralSSE42;
+#endif
+
+  return scanStructuralScalar;
+}
+
+/* 
+   count-only engine: reads the Newick string once and only keeps one 
+   child counter per currently open parenthesis, i.e., memory is 
+   O(tree depth) instead of O(taxa). No node graph is built and the 
+   multifurcations are not resolved, we just record the degree of every 
+   polytomy in a histogram as soon as it is closed.
+
+   The input is consumed block-wise via the structural index, quotes and 
+   comments are tracked here since the scanners are context-free. 
+*/
+
+static boolean countConstraintStream(treeReader *rd, tree *tr)
+{
+  structuralScanner
+    scan = selectStructuralScanner();
+
+  uint32_t
+    *index;
+
+  int
+    *childCount,
+    depth = 0,
+    unary = 0,
+    pending = 0,
+    commentDepth = 0,
+    degree,
+    ch;
+
+  size_t
+    blockSize = STRUCTURAL_FIRST_BLOCK_SIZE,
+    block,
+    gap,
+    position,
+    entries,
+    k;
+
+  boolean
+    started = FALSE,
+    done = FALSE,
+    quoted = FALSE,
+    quoteClosing = FALSE,
+    expectElement = FALSE,
+    content = FALSE;
+
+  degreeHistogram
+    *histogram = treeHistogram(tr);
+
+  tr->ntips  = 0;
+  tr->rooted = FALSE;
+
+  /* the scratch buffers are kept for the next tree of a collection */
+
+  if(tr->scanIndex == (uint32_t *)NULL)
+    {
+      tr->scanIndex      = (uint32_t*)malloc(sizeof(uint32_t) * STRUCTURAL_BLOCK_SIZE);
+      tr->childCountSize = 64;
+      tr->childCount     = (int*)malloc(sizeof(int) * tr->childCountSize);
+    }
+
+  index      = tr->scanIndex;
+  childCount = tr->childCount;
+
+  while(!done)
+    {
+      if(rd->position == rd->length && !fillTreeReader(rd))
+	break;
+
+      block = rd->length - rd->position;
+      if(block > blockSize)
+	block = blockSize;
+
+      if(blockSize < STRUCTURAL_BLOCK_SIZE)
+	blockSize *= 2;
+
+      entries = scan(&(rd->buffer[rd->position]), block, index);
+
+      /* gap is the first byte after the last structural character */
+
+      gap = rd->position;
+
+      for(k = 0; k < entries && !done; k++)
+	{
+	  position = rd->position + index[k];
+	  ch = rd->buffer[position];
+
+	  if(quoteClosing)
+	    {
+	      quoteClosing = FALSE;
+
+	      /* a doubled quote inside a quoted label */
+
+	      if(ch == '\'' && position == gap)
+		{
+		  quoted = TRUE;
+		  gap = position + 1;
+		  continue;
+		}
+	    }
+
+	  if(quoted)
+	    {
+	      if(ch == '\'')
+		{
+		  quoted = FALSE;
+		  quoteClosing = TRUE;
+		  gap = position + 1;
+		}
+	      continue;
+	    }
+
+	  if(commentDepth > 0)
+	    {
+	      if(ch == '[')
+		commentDepth++;
+	      if(ch == ']')
+		commentDepth--;
+	      gap = position + 1;
+	      continue;
+	    }
+
+	  /* is there a label between the previous structural character and this one? */
+
+	  if(expectElement && !content)
+	    {
+	      for(; gap < position && !content; gap++)
+		content = !whitechar(rd->buffer[gap]);
+	    }
+
+	  gap = position + 1;
+
+	  switch(ch)
+	    {
+	    case '[':
+	      commentDepth = 1;
+	      break;
+	    case '\'':
+	      quoted = TRUE;
+	      if(expectElement)
+		content = TRUE;
+	      break;
+	    case ']':
+	      if(expectElement)
+		content = TRUE;
+	      break;
+	    case '(':
+	      if(!started || (expectElement && !content))
+		{
+		  if(depth == tr->childCountSize)
+		    {
+		      tr->childCountSize *= 2;
+		      tr->childCount = (int*)realloc(tr->childCount, sizeof(int) * tr->childCountSize);
+		      childCount = tr->childCount;
+		    }
+		  if(unary == depth)
+		    unary++;
+		  childCount[depth++] = 1;
+		  started = TRUE;
+		  expectElement = TRUE;
+		  content = FALSE;
+		}
+	      else
+		{
+		  fprintf(rd->messages, "ERROR: Unexpected ( in constraint tree; found:");
+		  goto fail;
+		}
+	      break;
+	    case ':':
+	      /* a branch length terminates a taxon label, the length itself is skipped as part of the gap */
+
+	      if(expectElement)
+		{
+		  if(!content)
+		    {
+		      fprintf(rd->messages, "ERROR: Expecting a taxon label in constraint tree; found:");
+		      goto fail;
+		    }
+		  tr->ntips++;
+		  expectElement = FALSE;
+		}
+	      break;
+	    case ',':
+	    case ')':
+	      if(!started)
+		break;
+	      
+	      if(depth == 0)
+		{
+		  fprintf(rd->messages, "ERROR: Expecting ';' at end of tree; found:");
+		  goto fail;
+		}
+
+	      if(expectElement)
+		{
+		  if(!content)
+		    {
+		      fprintf(rd->messages, "ERROR: Expecting a taxon label in constraint tree; found:");
+		      goto fail;
+		    }
+		  tr->ntips++;
+		  expectElement = FALSE;
+		}
+
+	      if(ch == ',')
+		{
+		  childCount[depth - 1]++;
+		  expectElement = TRUE;
+		  content = FALSE;
+
+		  /* the held back node is not below a chain of single children any more */
+
+		  if(unary >= depth)
+		    {
+		      unary = depth - 1;
+		      addDegree(histogram, pending, 1);
+		      pending = 0;
+		    }
+		}
+
+	      if(ch == ')')
+		{
+		  degree = childCount[--depth];
+	      
+		  /* 
+		     the outermost node of an unrooted tree with k children resolves 
+		     like an inner node with k - 1 children, for a rooted tree (k = 2)
+		     this yields a factor of 1 and the root simply vanishes. 
+
+		     A root with a single child is just a unary edge and the rule 
+		     applies to the first node below it with more than one child. 
+		     That node is closed before the root, so a node whose ancestors 
+		     all have a single child so far is held back in pending until 
+		     we know whether it is the outermost one.
+		  */
+		  
+		  if(depth == 0)
+		    {
+		      if(degree == 1)
+			{
+			  degree = pending;
+			  pending = 0;
+			}
+		      if(degree == 2)
+			tr->rooted = TRUE;
+		      degree--;
+		    }
+		  else
+		    if(unary >= depth)
+		      {
+			unary = depth;
+			if(degree > 1)
+			  {
+			    pending = degree;
+			    degree = 0;
+			  }
+		      }
+
+		  addDegree(histogram, degree, 1);
+		}
+	      break;
+	    case ';':
+	      if(!started)
+		break;
+
+	      if(depth > 0)
+		{
+		  fprintf(rd->messages, "Missing /) in countConstraintStream\n");
+		  goto fail;
+		}
+	      done = TRUE;
+	      break;
+	    default:
+	      assert(0);
+	    }
+	}
+
+      /* the label of the current element may continue in the next block */
+
+      if(!done && !quoted && commentDepth == 0 && expectElement && !content)
+	{
+	  for(; gap < rd->position + block && !content; gap++)
+	    content = !whitechar(rd->buffer[gap]);
+	}
+
+      /* a closing quote that is not the last byte of the block can not be doubled any more */
+
+      if(quoteClosing && gap != rd->position + block)
+	quoteClosing = FALSE;
+
+      /* the next tree of a collection starts right after the ';' */
+
+      if(done)
+	rd->position = position + 1;
+      else
+	rd->position += block;
+    }
+  
+  if(!done)
+    {
+      if(!started)
+	fprintf(rd->messages, "ERROR: Constraint tree %s does not contain an opening parenthesis\n", tr->fileName);
+      else
+	fprintf(rd->messages, "ERROR: Expecting ';' at end of tree; found: End-of-File\n");
+      return FALSE;
+    }
+
+  return TRUE;
+
+ fail:
+  rd->position = position;
+  treeEchoContext(rd, rd->messages, 40);
+  fprintf(rd->messages, "\n");
+
+  return FALSE;
+}
+
+
+/* 
+   parallel version of the count-only engine for memory mapped input: the 
+   tree is split into one chunk per thread. Since parentheses, commas and 
+   labels can be classified without context as long as there are no quotes 
+   and comments, every chunk computes its depth prefix independently, i.e., 
+   the comma counts of the levels it closes without having opened them 
+   (outer), the counters of the levels it leaves open (open) and a histogram 
+   of the degrees of all polytomies it opens and closes itself. The chunks 
+   are then merged in order on a global stack. Input with quotes or comments 
+   is handed back to the sequential engine.
+*/
+
+#define MIN_CHUNK_SIZE (1 << 20)
+
+typedef struct
+{
+  const char *buffer;
+  size_t      start;
+  size_t      end;
+  size_t      length;
+
+  int        *outer;
+  int         outerCount;
+  int         outerSize;
+  int        *open;
+  int         openCount;
+  int         openSize;
+  degreeHistogram *histogram;
+  int         tips;
+
+  boolean     semicolon;
+  boolean     sequential;
+  const char *error;
+  size_t      errorPosition;
+}
+  parseChunk;
+
+static int *growIntArray(int *a, int *size, int needed)
+{
+  int
+    oldSize = *size;
+
+  if(needed < oldSize)
+    return a;
+
+  while(*size <= needed)
+    *size *= 2;
+
+  a = (int*)realloc(a, sizeof(int) * (*size));
+  assert(a);
+  memset(&a[oldSize], 0, sizeof(int) * (*size - oldSize));
+
+  return a;
+}
+
+/* 
+   classifies the element that starts after the ( or , at position, the whole 
+   input is mapped, hence we may look beyond the end of the chunk
+*/
+
+static void checkChunkElement(parseChunk *c, size_t position)
+{
+  int 
+    ch = EOF;
+
+  for(position++; position < c->length; position++)
+    if(!whitechar(ch = (unsigned char)c->buffer[position]))
+      break;
+
+  if(position == c->length)
+    ch = EOF;
+
+  switch(ch)
+    {
+    case '(':
+      break;
+    case '[':
+    case ']':
+    case '\'':
+      c->sequential = TRUE;
+      break;
+    case EOF:
+    case ',':
+    case ')':
+    case ':':
+    case ';':
+      if(!c->error)
+	{
+	  c->error = "ERROR: Expecting a taxon label in constraint tree; found:";
+	  c->errorPosition = position;
+	}
+      break;
+    default:
+      c->tips++;
+    }
+}
+
+static void *parseChunkWorker(void *arg)
+{
+  parseChunk 
+    *c = (parseChunk *)arg;
+
+  structuralScanner
+    scan = selectStructuralScanner();
+
+  uint32_t
+    *index = (uint32_t*)malloc(sizeof(uint32_t) * STRUCTURAL_BLOCK_SIZE);
+
+  size_t
+    blockStart,
+    block,
+    entries,
+    position,
+    i,
+    k;
+
+  int 
+    degree;
+
+  for(blockStart = c->start; blockStart < c->end && !c->semicolon && !c->sequential && !c->error; blockStart += block)
+    {
+      block = c->end - blockStart;
+      if(block > STRUCTURAL_BLOCK_SIZE)
+	block = STRUCTURAL_BLOCK_SIZE;
+
+      entries = scan(&(c->buffer[blockStart]), block, index);
+
+      for(k = 0; k < entries && !c->semicolon && !c->sequential && !c->error; k++)
+	{
+	  position = blockStart + index[k];
+
+	  switch(c->buffer[position])
+	    {
+	    case '[':
+	    case ']':
+	    case '\'':
+	      c->sequential = TRUE;
+	      break;
+	    case '(':
+	      /* a subtree must start right after a ( or a , */
+
+	      for(i = position; i > 0 && whitechar(c->buffer[i - 1]); i--)
+		;
+
+	      if(i == 0 || (c->buffer[i - 1] != '(' && c->buffer[i - 1] != ','))
+		{
+		  c->error = "ERROR: Unexpected ( in constraint tree; found:";
+		  c->errorPosition = position;
+		  break;
+		}
+
+	      c->open = growIntArray(c->open, &(c->openSize), c->openCount);
+	      c->open[c->openCount++] = 1;
+	      checkChunkElement(c, position);
+	      break;
+	    case ',':
+	      if(c->openCount > 0)
+		c->open[c->openCount - 1]++;
+	      else
+		c->outer[c->outerCount - 1]++;
+	      checkChunkElement(c, position);
+	      break;
+	    case ')':
+	      if(c->openCount > 0)
+		{
+		  degree = c->open[--(c->openCount)];
+		  addDegree(c->histogram, degree, 1);
+		}
+	      else
+		{
+		  c->outer = growIntArray(c->outer, &(c->outerSize), c->outerCount);
+		  c->outer[c->outerCount++] = 0;
+		}
+	      break;
+	    case ';':
+	      c->semicolon = TRUE;
+	      break;
+	    default:
+	      break;
+	    }
+	}
+    }
+
+  free(index);
+
+  return (void *)NULL;
+}
+
+static boolean countConstraintParallel(treeReader *rd, tree *tr)
+{
+  parseChunk
+    *chunks = (parseChunk *)calloc((size_t)tr->threads, sizeof(parseChunk)),
+    *c;
+
+  pthread_t
+    *threads = (pthread_t *)malloc(sizeof(pthread_t) * tr->threads);
+
+  int
+    *stack = (int *)NULL,
+    stackSize = 64,
+    depth = 0,
+    chunkCount,
+    started = 0,
+    degree,
+    i,
+    j;
+
+  size_t
+    root,
+    chunkSize;
+
+  boolean
+    done = FALSE,
+    success = FALSE;
+
+  degreeHistogram
+    *histogram;
+
+  /* the preamble up to the opening parenthesis of the root is skipped sequentially */
+
+  for(root = 0; root < rd->length && rd->buffer[root] != '(' && rd->buffer[root] != '[' && rd->buffer[root] != '\''; root++)
+    ;
+
+  chunkSize = (rd->length - root + tr->threads - 1) / tr->threads;
+  if(chunkSize < MIN_CHUNK_SIZE)
+    chunkSize = MIN_CHUNK_SIZE;
+
+  if(root == rd->length || rd->buffer[root] != '(')
+    {
+      free(chunks);
+      free(threads);
+      return countConstraintStream(rd, tr);
+    }
+
+  for(i = 0, chunkCount = 0; i < tr->threads && root + 1 + i * chunkSize < rd->length; i++, chunkCount++)
+    {
+      c = &chunks[i];
+
+      c->buffer = rd->buffer;
+      c->length = rd->length;
+      c->start  = root + 1 + i * chunkSize;
+      c->end    = c->start + chunkSize;
+      if(c->end > rd->length)
+	c->end = rd->length;
+
+      c->outerSize = c->openSize = 64;
+      c->outer      = (int*)calloc(c->outerSize, sizeof(int));
+      c->open       = (int*)calloc(c->openSize, sizeof(int));
+      c->histogram  = initDegreeHistogram();
+      c->outerCount = 1;
+
+      if(i == 0)
+	checkChunkElement(c, root);
+
+      if(pthread_create(&threads[i], (pthread_attr_t *)NULL, parseChunkWorker, (void *)c) != 0)
+	{
+	  chunkCount++;
+	  break;
+	}
+
+      started++;
+    }
+
+  for(i = 0; i < started; i++)
+    pthread_join(threads[i], (void **)NULL);
+
+  /* without all threads the chunks can not be merged, the input is counted sequentially */
+
+  if(started < chunkCount)
+    goto sequential;
+
+  /* merge the chunks in input order, the root is the bottom of the stack */
+
+  stack = (int*)calloc(stackSize, sizeof(int));
+  histogram = treeHistogram(tr);
+  stack[depth++] = 1;
+
+  tr->ntips  = 0;
+  tr->rooted = FALSE;
+
+  for(i = 0; i < chunkCount && !done; i++)
+    {
+      c = &chunks[i];
+
+      if(c->sequential)
+	goto sequential;
+
+      if(c->error)
+	{
+	  fprintf(rd->messages, "%s", c->error);
+	  rd->position = c->errorPosition;
+	  treeEchoContext(rd, rd->messages, 40);
+	  fprintf(rd->messages, "\n");
+	  goto cleanup;
+	}
+
+      tr->ntips += c->tips;
+
+      mergeDegreeHistogram(histogram, c->histogram);
+
+      for(j = 0; j < c->outerCount; j++)
+	{
+	  if(depth == 0)
+	    {
+	      if(c->outer[j] > 0 || j < c->outerCount - 1 || c->openCount > 0)
+		{
+		  fprintf(rd->messages, "ERROR: Expecting ';' at end of tree\n");
+		  goto cleanup;
+		}
+	      continue;
+	    }
+
+	  stack[depth - 1] += c->outer[j];
+
+	  if(j < c->outerCount - 1)
+	    {
+	      degree = stack[--depth];
+
+	      /* 
+		 same treatment of the outermost node as in countConstraintStream(), 
+		 the first node below a single-child root may have been closed 
+		 inside a chunk, such rare trees are counted sequentially 
+	      */
+
+	      if(depth == 0)
+		{
+		  if(degree == 1)
+		    goto sequential;
+		  if(degree == 2)
+		    tr->rooted = TRUE;
+		  degree--;
+		}
+
+	      addDegree(histogram, degree, 1);
+	    }
+	}
+
+      for(j = 0; j < c->openCount; j++)
+	{
+	  stack = growIntArray(stack, &stackSize, depth);
+	  stack[depth++] = c->open[j];
+	}
+
+      if(c->semicolon)
+	{
+	  if(depth > 0)
+	    {
+	      fprintf(rd->messages, "Missing /) in countConstraintParallel\n");
+	      goto cleanup;
+	    }
+	  done = TRUE;
+	}
+    }
+
+  if(!done)
+    {
+      fprintf(rd->messages, "ERROR: Expecting ';' at end of tree; found: End-of-File\n");
+      goto cleanup;
+    }
+
+  success = TRUE;
+  goto cleanup;
+
+ sequential:
+  rd->position = 0;
+  success = countConstraintStream(rd, tr);
+
+ cleanup:
+  for(i = 0; i < chunkCount; i++)
+    {
+      free(chunks[i].outer);
+      free(chunks[i].open);
+      freeDegreeHistogram(chunks[i].histogram);
+    }
+
+  free(chunks);
+  free(threads);
+  free(stack);
+
+  return success;
+}
+
+/* 
+   reads the next tree of rd into the degree histogram of tr, the parallel 
+   count-only parser splits the whole input and hence only reads single trees
+*/
+
+static boolean readConstraintTree(treeReader *rd, tree *tr)
+{
+  boolean 
+    success;
+
+  tr->status = TREE_COUNTER_OK;
+
+  if(tr->countOnly && tr->threads > 1 && rd->mapped && !tr->batch && rd->position == 0)
+    success = countConstraintParallel(rd, tr);
+  else if(tr->countOnly)
+    success = countConstraintStream(rd, tr);
+  else
+    success = treeReadLenMULT(rd, tr);
+
+  if(!success && tr->status == TREE_COUNTER_OK)
+    tr->status = TREE_COUNTER_SYNTAX_ERROR;
+
+  return success;
+}
+
+static void freeTreeContext(tree *tr)
+{
+  if(tr->nameHash)
+    {
+      freeStringHashTable(tr->nameHash);
+      free(tr->topo.parent);
+      free(tr->topo.firstChild);
+      free(tr->topo.sibling);
+      free(tr->topo.taxon);
+      free(tr->frames);
+    }
+
+  if(tr->histogram)
+    freeDegreeHistogram(tr->histogram);
+
+  if(tr->topologies)
+    freeTopologySet(tr->topologies);
+
+  free(tr->scanIndex);
+  free(tr->childCount);
+}
+
+/* the defaults of all options, the buffers are allocated by the first tree */
+
+static void initTree(tree *tr)
+{
+  tr->mxtips = 0;
+  tr->ntips = 0;
+  tr->rooted = FALSE;
+  tr->parseTree = FALSE;
+  tr->countOnly = FALSE;
+  tr->threads = 1;
+  tr->useCache = FALSE;
+  tr->cacheTaxa = 0;
+  tr->approximate = FALSE;
+  tr->numTaxa = 0;
+  tr->format = FORMAT_DEC;
+  tr->factored = FALSE;
+  tr->expand = FALSE;
+  tr->rangeFrom = 0;
+  tr->rangeStride = 0;
+  tr->batch = FALSE;
+  tr->unique = FALSE;
+  tr->treeIndex = 0;
+  tr->nameHash = (stringHashtable *)NULL;
+  tr->histogram = (degreeHistogram *)NULL;
+  tr->topologies = (topologySet *)NULL;
+  tr->scanIndex = (uint32_t *)NULL;
+  tr->childCount = (int *)NULL;
+  tr->fileName = "";
+  tr->rowFile = stdout;
+  tr->messageFile = stdout;
+  tr->fileNames = (char **)NULL;
+  tr->fileCount = 0;
+  tr->fileSize = 0;
+  tr->multiFile = FALSE;
+  tr->server = FALSE;
+  tr->status = TREE_COUNTER_OK;
+}
+
+/* 
+   the library, a context is a tree with its buffers and a stream that 
+   collects the messages of the current call 
+*/
+
+struct treeCounterContext
+{
+  tree             tr;
+  FILE            *messages;
+  char            *messageText;
+  size_t           messageLength;
+};
+
+treeCounterContext *treeCounterCreate(int threads, int flags)
+{
+  treeCounterContext 
+    *c;
+
+  if(threads < 1)
+    return (treeCounterContext *)NULL;
+
+  c = (treeCounterContext *)malloc(sizeof(treeCounterContext));
+  if(!c)
+    return c;
+
+  initTree(&(c->tr));
+
+  c->tr.threads   = threads;
+  c->tr.countOnly = ((flags & TREE_COUNTER_COUNT_ONLY) != 0);
+
+  c->messageText   = (char *)NULL;
+  c->messageLength = 0;
+  c->messages      = open_memstream(&(c->messageText), &(c->messageLength));
+
+  if(!c->messages)
+    {
+      free(c);
+      return (treeCounterContext *)NULL;
+    }
+
+  return c;
+}
+
+void treeCounterFree(treeCounterContext *c)
+{
+  if(!c)
+    return;
+
+  freeTreeContext(&(c->tr));
+  fclose(c->messages);
+  free(c->messageText);
+  free(c);
+}
+
+void treeCounterInitResult(treeCounterResult *r)
+{
+  r->taxa              = 0;
+  r->maxMultifurcation = -1;
+  r->rooted            = FALSE;
+  mpz_init(r->count);
+}
+
+void treeCounterClearResult(treeCounterResult *r)
+{
+  mpz_clear(r->count);
+}
+
+/* every call starts with an empty message */
+
+static void clearMessages(treeCounterContext *c)
+{
+  fclose(c->messages);
+  free(c->messageText);
+
+  c->messageText   = (char *)NULL;
+  c->messageLength = 0;
+  c->messages      = open_memstream(&(c->messageText), &(c->messageLength));
+
+  assert(c->messages);
+}
+
+static int countReader(treeCounterContext *c, treeReader *rd, treeCounterResult *r)
+{
+  tree
+    *tr = &(c->tr);
+
+  rd->messages = c->messages;
+  tr->fileName = (rd->borrowed) ? "buffer" : "file descriptor";
+
+  if(!readConstraintTree(rd, tr))
+    return tr->status;
+
+  if(tr->ntips < 4)
+    {    
+      fprintf(c->messages, "TOO FEW SPECIES, tree contains only %d species\n", tr->ntips);
+      return TREE_COUNTER_TOO_FEW_TAXA;
+    }
+
+  r->taxa              = tr->ntips;
+  r->maxMultifurcation = tr->histogram->max;
+  r->rooted            = tr->rooted;
+
+  cachedHistogramProduct(r->count, tr->histogram, tr->threads);
+
+  return TREE_COUNTER_OK;
+}
+
+int treeCounterCountBuffer(treeCounterContext *c, const char *buffer, size_t length, treeCounterResult *r)
+{
+  treeReader
+    rd;
+
+  int
+    status;
+
+  clearMessages(c);
+
+  if(!buffer)
+    {
+      fprintf(c->messages, "No buffer given\n");
+      return TREE_COUNTER_ARGUMENT_ERROR;
+    }
+
+  openTreeReaderBuffer(&rd, buffer, length);
+
+  status = countReader(c, &rd, r);
+
+  closeTreeReader(&rd);
+
+  return status;
+}
+
+int treeCounterCountFd(treeCounterContext *c, int fd, treeCounterResult *r)
+{
+  treeReader
+    rd;
+
+  int
+    status;
+
+  clearMessages(c);
+
+  if(fd < 0 || !openTreeReaderFd(&rd, fd))
+    {
+      fprintf(c->messages, "Unable to read from file descriptor %d\n", fd);
+      return TREE_COUNTER_IO_ERROR;
+    }
+
+  status = countReader(c, &rd, r);
+
+  closeTreeReader(&rd);
+
+  return status;
+}
+
+int treeCounterCountTaxa(treeCounterContext *c, long long taxa, int rooted, treeCounterResult *r)
+{
+  clearMessages(c);
+
+  if(taxa < 3)
+    {
+      fprintf(c->messages, "A tree with less than 3 taxa?\n");
+      return TREE_COUNTER_ARGUMENT_ERROR;
+    }
+
+  if(taxa > INT_MAX / 2)
+    {
+      fprintf(c->messages, "The exact number of trees for %lld taxa is too large\n", taxa);
+      return TREE_COUNTER_TOO_LARGE;
+    }
+
+  /* (2n - 5)!! unrooted trees, (2n - 3)!! rooted trees */
+
+  oddDoubleFactorial(r->count, (unsigned long int)(2 * taxa - 5), c->tr.threads);
+
+  if(rooted)
+    mpz_mul_ui(r->count, r->count, (unsigned long int)(2 * taxa - 3));
+
+  r->taxa              = taxa;
+  r->maxMultifurcation = -1;
+  r->rooted            = (rooted != 0);
+
+  return TREE_COUNTER_OK;
+}
+
+/* the double factorial cache is shared by all contexts and must not change while they count */
+
+int treeCounterOpenCache(const char *fileName)
+{
+  closeDoubleFactorialCache();
+
+  return openDoubleFactorialCache(fileName) ? TREE_COUNTER_OK : TREE_COUNTER_IO_ERROR;
+}
+
+void treeCounterCloseCache(void)
+{
+  closeDoubleFactorialCache();
+}
+
+/* the result cache directory, NULL disables it, the same rules as for the double factorial cache apply */
+
+int treeCounterSetResultCache(const char *directory)
+{
+  if(!directory)
+    {
+      resultCacheDir[0] = '\0';
+      return TREE_COUNTER_OK;
+    }
+
+  if(strlen(directory) >= sizeof(resultCacheDir) - 32 || (mkdir(directory, 0777) != 0 && errno != EEXIST))
+    return TREE_COUNTER_IO_ERROR;
+
+  strcpy(resultCacheDir, directory);
+
+  return TREE_COUNTER_OK;
+}
+
+const char *treeCounterErrorMessage(treeCounterContext *c)
+{
+  fflush(c->messages);
+
+  return (c->messageText) ? c->messageText : "";
+}
+
+const char *treeCounterStatusString(int status)
+{
+  switch(status)
+    {
+    case TREE_COUNTER_OK:
+      return "ok";
+    case TREE_COUNTER_ARGUMENT_ERROR:
+      return "invalid argument";
+    case TREE_COUNTER_IO_ERROR:
+      return "input error";
+    case TREE_COUNTER_SYNTAX_ERROR:
+      return "syntax error in Newick tree";
+    case TREE_COUNTER_DUPLICATE_TAXON:
+      return "duplicate taxon";
+    case TREE_COUNTER_TOO_FEW_TAXA:
+      return "too few taxa";
+    case TREE_COUNTER_TOO_LARGE:
+      return "count too large";
+    default:
+      return "unknown status";
+    }
+}
+
+#ifndef TREECOUNTER_LIBRARY
+
+
+/* long options --name=value, --name value or --name are mapped to the short option c */
+
+typedef struct
+{
+  const char *name;
+  int         c;
+}
+  longOption;
+
+static const longOption longOptions[] = 
+{
+  {"format", 'f'},
+  {"factored", 'F'},
+  {"expand", 'E'},
+  {"batch", 'b'},
+  {"unique", 'u'},
+  {"server", 'S'},
+  {"result-cache", 'R'},
+  {(const char *)NULL, 0}
+};
+
+static int mygetopt(int argc, char **argv, char *opts, int *optind, char **optarg)
+{
+  static int sp = 1;
+  register int c;
+  register char *cp;
+
+  if(sp == 1)
+    {
+      if(*optind >= argc || argv[*optind][0] != '-' || argv[*optind][1] == '\0')
+	return -1;
+
+      if(argv[*optind][1] == '-' && argv[*optind][2] != '\0')
+	{
+	  const longOption 
+	    *l;
+
+	  char 
+	    *name = &argv[*optind][2],
+	    *value = strchr(name, '=');
+
+	  size_t 
+	    length = value ? (size_t)(value - name) : strlen(name);
+
+	  for(l = longOptions; l->name; l++)
+	    if(strlen(l->name) == length && strncmp(l->name, name, length) == 0)
+	      break;
+
+	  *optind =  *optind + 1;
+
+	  if(!l->name || !(cp = strchr(opts, l->c)))
+	    {
+	      printf(": illegal option -- %s \n", name);
+	      return('?');
+	    }
+
+	  /* the argument convention is the one of the short option */
+
+	  if(cp[1] != ':')
+	    {
+	      *optarg = 0;
+	      return value ? '?' : l->c;
+	    }
+
+	  if(value)
+	    *optarg = value + 1;
+	  else if(*optind < argc)
+	    {
+	      *optarg = argv[*optind];
+	      *optind =  *optind + 1;
+	    }
+	  else
+	    {
+	      printf(": option requires an argument -- %s\n", l->name);
+	      return('?');
+	    }
+
+	  return l->c;
+	}
+    }
+  else
+    {
+      if(strcmp(argv[*optind], "--") == 0)
+	{
+	  *optind =  *optind + 1;
+	  return -1;
+	}
+    }
+
+  c = argv[*optind][sp];
+  if(c == ':' || (cp=strchr(opts, c)) == 0)
+    {
+      printf(": illegal option -- %c \n", c);
+      if(argv[*optind][++sp] == '\0')
+	{
+	  *optind =  *optind + 1;
+	  sp = 1;
+	}
+      return('?');
+    }
+  if(*++cp == ':')
+    {
+      if(argv[*optind][sp+1] != '\0')
+	{
+	  *optarg = &argv[*optind][sp+1];
+	  *optind =  *optind + 1;
+	}
+      else
+	{
+	  *optind =  *optind + 1;
+	  if(*optind >= argc)
+	    {
+	      printf(": option requires an argument -- %c\n", c);
+	      sp = 1;
+	      return('?');
+	    }
+	  else
+	    {
+	      *optarg = argv[*optind];
+	      *optind =  *optind + 1;
+	    }
+	}
+      sp = 1;
+    }
+  else
+    {
+      if(argv[*optind][++sp] == '\0')
+	{
+	  sp = 1;
+	  *optind =  *optind + 1;
+	}
+      *optarg = 0;
+    }
+  return(c);
+  }
+
+
+static void printHelp(void)
+{
+  printf("\n\nThis is the tree counter program released in June 2011 by Alexandros Stamatakis\n");
+  printf("it can either compute the number of possible bifurcating trees for n taxa via the\n\n");
+  printf(" -n numberOfTaxa\n\n");
+  printf("option, -n from:to or -n from:to:stride prints a table of the counts for every\n");
+  printf("stride-th number of taxa in the range in one incremental pass, or .... \n\n");
+  printf("Compute the number of possible bifurcating trees for a multi-furcating \n");
+  printf("Newick constraint tree passed via the \n\n");
+  printf(" -t constraintTreeFileName\n\n");
+  printf("option. The constraint tree format must be RAxML readable, use - as file name\n");
+  printf("to read the constraint tree from standard input. -t also takes a directory, a\n");
+  printf("glob pattern or several files, the files are then counted by the threads of -T\n");
+  printf("and one row per file is printed in input order.\n\n");
+  printf(" -c\n\n");
+  printf("can be used together with -t to only count the trees without building the tree\n");
+  printf("data structure, memory requirements then only depend on the depth of the tree\n");
+  printf("and not on the number of taxa any more.\n\n");
+  printf(" -T numberOfThreads\n\n");
+  printf("computes the big products of -n and -t with a multithreaded product tree and\n");
+  printf("splits a memory mapped constraint tree that is counted via -c into chunks that\n");
+  printf("are parsed in parallel.\n\n");
+  printf(" -a\n\n");
+  printf("only prints the certified leading digits of the number of trees of -n or -t,\n");
+  printf("computed in log space in constant time and memory, e.g., for 10^15 taxa.\n\n");
+  printf(" -C cacheFileName\n\n");
+  printf("starts the double factorials of -n and -t from the nearest checkpoint stored in\n");
+  printf("a memory mapped cache file, a missing or unusable cache is ignored.\n\n");
+  printf(" -B numberOfTaxa\n\n");
+  printf("(re)builds the cache file given via -C with the checkpoints for trees with up to\n");
+  printf("numberOfTaxa taxa, may be used alone or together with -n or -t.\n\n");
+  printf(" --format=dec|hex|raw|json or -f dec|hex|raw|json\n\n");
+  printf("selects how exact counts are printed: decimal (default) or hexadecimal digits,\n");
+  printf("the binary mpz_out_raw() format of GMP or one JSON object per line. With raw\n");
+  printf("and json only the counts are written to standard output, all other messages\n");
+  printf("go to standard error.\n\n");
+  printf(" -F or --factored\n\n");
+  printf("prints the counts of -n and -t as prime factorizations obtained via Legendre's\n");
+  printf("formula, for -t also the reduced ratio of the constrained count to the number\n");
+  printf("of all unrooted trees for the same taxa, no big numbers are multiplied.\n\n");
+  printf(" -E or --expand\n\n");
+  printf("additionally expands the factorizations of -F to exact numbers.\n\n");
+  printf(" -b or --batch\n\n");
+  printf("counts every tree of the tree collection passed via -t, e.g., a bootstrap file,\n");
+  printf("and prints one row per tree with the tree number, the number of taxa, the size\n");
+  printf("of the largest multifurcation and the count. The trees may be defined on\n");
+  printf("different sets of taxa, the buffers of the first tree are reused.\n\n");
+  printf(" -u or --unique\n\n");
+  printf("like -b, but counts every distinct unrooted topology of the collection only\n");
+  printf("once, e.g., of a posterior sample. Trees are identified by the taxon labels,\n");
+  printf("the order of the children, the rooting and branch lengths do not matter. One\n");
+  printf("row per topology is printed in the order of first appearance, with the number\n");
+  printf("of its first tree and the number of copies in the collection.\n\n");
+  printf(" -R directory or --result-cache directory\n\n");
+  printf("stores the exact constraint counts of -t and of the server mode in directory,\n");
+  printf("keyed by the multiset of the degrees of the multifurcations, a tree with the\n");
+  printf("same degrees is then only looked up instead of multiplied out again.\n\n");
+  printf(" -S socketFileName or --server socketFileName\n\n");
+  printf("answers requests over a Unix domain socket with -T threads until SIGINT or\n");
+  printf("SIGTERM, the cache of -C stays mapped. A request is a line n numberOfTaxa\n");
+  printf("[rooted] or a line tree numberOfBytes followed by the Newick tree, the answer\n");
+  printf("is a line ok taxa maxMultifurcation rooted count or error reason: message.\n");
+  printf("\n\n");
+}
+
+/* 
+   an argument that is not an option is returned as option 0, these are 
+   further constraint tree files of -t, e.g., expanded from a shell glob 
+*/
+
+static int nextArgument(int argc, char **argv, char *opts, int *optind, char **optarg)
+{
+  int 
+    c = mygetopt(argc, argv, opts, optind, optarg);
+
+  if(c == -1 && *optind < argc)
+    {
+      *optarg = argv[*optind];
+      *optind = *optind + 1;
+      return 0;
+    }
+
+  return c;
+}
+
+static void addTreeFile(tree *tr, const char *fileName)
+{
+  if(tr->fileCount == tr->fileSize)
+    {
+      tr->fileSize  = (tr->fileSize == 0) ? 64 : 2 * tr->fileSize;
+      tr->fileNames = (char **)realloc(tr->fileNames, sizeof(char *) * tr->fileSize);
+      assert(tr->fileNames);
+    }
+
+  tr->fileNames[tr->fileCount] = (char *)malloc(strlen(fileName) + 1);
+  assert(tr->fileNames[tr->fileCount]);
+  strcpy(tr->fileNames[tr->fileCount], fileName);
+
+  tr->fileCount++;
+}
+
+static int compareFileNames(const void *a, const void *b)
+{
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* 
+   -t takes a file, a directory, i.e., all regular files in it that do not 
+   start with a dot, or a glob pattern, both in lexicographic order
+*/
+
+static void addTreeFiles(tree *tr, const char *name)
+{
+  struct stat 
+    st;
+
+  if(strcmp(name, "-") != 0 && stat(name, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+      DIR 
+	*d = opendir(name);
+
+      struct dirent 
+	*e;
+
+      char 
+	path[4096];
+
+      int 
+	first = tr->fileCount;
+
+      if(!d)
+	{
+	  printf("Unable to read the constraint tree directory %s\n", name);
+	  exit(-1);
+	}
+
+      while((e = readdir(d)) != (struct dirent *)NULL)
+	{
+	  if(e->d_name[0] == '.')
+	    continue;
+
+	  if(snprintf(path, sizeof(path), "%s/%s", name, e->d_name) >= (int)sizeof(path))
+	    continue;
+
+	  if(stat(path, &st) == 0 && S_ISREG(st.st_mode))
+	    addTreeFile(tr, path);
+	}
+
+      closedir(d);
+
+      qsort(&(tr->fileNames[first]), (size_t)(tr->fileCount - first), sizeof(char *), compareFileNames);
+
+      tr->multiFile = TRUE;
+
+      return;
+    }
+
+  if(strpbrk(name, "*?[") && stat(name, &st) != 0)
+    {
+      glob_t 
+	g;
+
+      size_t 
+	i;
+
+      if(glob(name, 0, NULL, &g) != 0)
+	{
+	  printf("No constraint tree file matches %s\n", name);
+	  exit(-1);
+	}
+
+      for(i = 0; i < g.gl_pathc; i++)
+	addTreeFile(tr, g.gl_pathv[i]);
+
+      globfree(&g);
+
+      tr->multiFile = TRUE;
+
+      return;
+    }
+
+  addTreeFile(tr, name);
+}
+
+static void get_args(int argc, char *argv[], tree *tr)
+{
+  boolean
+    bad_opt    =FALSE;
+
+  char          
+    *optarg;
+    
+  int  
+    optind = 1,        
+    c;
+
+  boolean 
+    numSet = FALSE,
+    constraintSet = FALSE;
+
+  initTree(tr);
+  
+ 
+  
+  /********* tr inits end*************/
+
+
+  while(!bad_opt &&
+	((c = nextArgument(argc,argv,"n:t:T:C:B:R:S:f:FEabuch", &optind, &optarg))!=-1))
+    {
+    switch(c)
+      {
+      case 'n':
+	if(strchr(optarg, ':'))
+	  {
+	    tr->rangeStride = 1;
+	    if(sscanf(optarg,"%lld:%lld:%lld", &(tr->rangeFrom), &(tr->numTaxa), &(tr->rangeStride)) < 2 || 
+	       tr->rangeFrom > tr->numTaxa || tr->rangeStride < 1)
+	      {
+		printf("Invalid range of taxa %s, use -n from:to or -n from:to:stride\n", optarg);
+		exit(-1);
+	      }
+	  }
+	else
+	  sscanf(optarg,"%lld", &(tr->numTaxa));
+	if(tr->numTaxa <= 2 || (tr->rangeStride > 0 && tr->rangeFrom <= 2))
+	  {
+	    printf("A tree with less than 3 taxa?\n");	   
+	    exit(-1);
+	  }
+	numSet = TRUE;
+	break;      
+      case 't':
+	tr->parseTree = TRUE;
+	addTreeFiles(tr, optarg);
+	constraintSet = TRUE;
+	break;           
+      case 0:
+	if(!constraintSet)
+	  {
+	    printf("Unexpected argument %s, further constraint tree files must follow -t\n", optarg);
+	    exit(-1);
+	  }
+	addTreeFiles(tr, optarg);
+	break;
+      case 'c':
+	tr->countOnly = TRUE;
+	break;
+      case 'a':
+	tr->approximate = TRUE;
+	break;
+      case 'b':
+	tr->batch = TRUE;
+	break;
+      case 'u':
+	tr->batch  = TRUE;
+	tr->unique = TRUE;
+	break;
+      case 'F':
+	tr->factored = TRUE;
+	break;
+      case 'E':
+	tr->expand = TRUE;
+	break;
+      case 'f':
+	if(strcmp(optarg, "dec") == 0)
+	  tr->format = FORMAT_DEC;
+	else if(strcmp(optarg, "hex") == 0)
+	  tr->format = FORMAT_HEX;
+	else if(strcmp(optarg, "raw") == 0)
+	  tr->format = FORMAT_RAW;
+	else if(strcmp(optarg, "json") == 0)
+	  tr->format = FORMAT_JSON;
+	else
+	  {
+	    printf("Unknown output format %s, use dec, hex, raw or json\n", optarg);
+	    exit(-1);
+	  }
+	break;
+      case 'T':
+	sscanf(optarg,"%d", &(tr->threads));
+	if(tr->threads < 1)
+	  {
+	    printf("The number of threads must be at least 1\n");
+	    exit(-1);
+	  }
+	break;
+      case 'R':
+	if(strlen(optarg) >= sizeof(resultCacheDir) - 32)
+	  {
+	    printf("The result cache directory name %s is too long\n", optarg);
+	    exit(-1);
+	  }
+	strcpy(resultCacheDir, optarg);
+	break;
+      case 'S':
+	if(strlen(optarg) >= sizeof(socketFileName))
+	  {
+	    printf("The socket file name %s is too long\n", optarg);
+	    exit(-1);
+	  }
+	tr->server = TRUE;
+	strcpy(socketFileName, optarg);
+	break;
+      case 'C':
+	if(strlen(optarg) >= sizeof(cacheFileName))
+	  {
+	    printf("The cache file name %s is too long\n", optarg);
+	    exit(-1);
+	  }
+	tr->useCache = TRUE;
+	strcpy(cacheFileName, optarg);
+	break;
+      case 'B':
+	sscanf(optarg,"%d", &(tr->cacheTaxa));
+	if(tr->cacheTaxa < 3)
+	  {
+	    printf("The cache must at least cover trees with 3 taxa\n");
+	    exit(-1);
+	  }
+	break;
+      case 'h':
+	printHelp();
+	exit(0);
+	break;
+      default:
+	printf("Option %c not supported\n", c);
+    }
+  }
+
+ 
+  if(constraintSet)
+    {
+      if(tr->fileCount == 0)
+	{
+	  printf("No constraint tree files found\n");
+	  exit(-1);
+	}
+
+      if(tr->fileCount > 1)
+	tr->multiFile = TRUE;
+
+      /* expanded names are not bounded, the tree refers to the list instead of a copy */
+
+      tr->fileName = tr->fileNames[0];
+    }
+
+  if(tr->cacheTaxa > 0 && !tr->useCache)
+    {
+      printf("Usage error building a cache via -B requires a cache file name via -C\n");
+      exit(-1);
+    }
+
+  if(tr->server && (numSet || constraintSet))
+    {
+      printf("Usage error the server mode -S receives the constraints and numbers of taxa over its socket\n");
+      exit(-1);
+    }
+
+  if((numSet && constraintSet) || (!(numSet || constraintSet) && tr->cacheTaxa == 0 && !tr->server))
+    {
+      printf("Usage error you need to either specify a constraint via -t\n");
+      printf("or the number of taxa via -n \n");
+      exit(-1);
+    }
+
+  if(numSet && !tr->approximate)
+    {
+      if(tr->numTaxa > INT_MAX / 2)
+	{
+	  printf("The exact number of trees for %lld taxa is too large, use -a for an approximation\n", tr->numTaxa);
+	  exit(-1);
+	}
+
+      tr->mxtips = (int)tr->numTaxa;
+    }
+
+  /* the decimal exponent of the count must fit into a long long */
+
+  if(numSet && tr->numTaxa > 100000000000000000LL)
+    {
+      printf("The number of taxa must not exceed 10^17\n");
+      exit(-1);
+    }
+
+  if(tr->factored && (tr->approximate || tr->format == FORMAT_RAW))
+    {
+      printf("Usage error the factored mode -F can neither be combined with -a nor with the raw output format\n");
+      exit(-1);
+    }
+
+  if(tr->factored && tr->rangeStride > 0)
+    {
+      printf("Usage error the factored mode -F can not be combined with a range of taxa\n");
+      exit(-1);
+    }
+
+  if(tr->expand && !tr->factored)
+    {
+      printf("Usage error -E expands the counts of the factored mode -F\n");
+      exit(-1);
+    }
+
+  if(tr->approximate && tr->format != FORMAT_DEC)
+    {
+      printf("Usage error the approximate mode -a only supports the dec output format\n");
+      exit(-1);
+    }
+
+  if(tr->countOnly && !constraintSet && !tr->server)
+    {
+      printf("Usage error the count-only mode -c can only be used with a constraint tree via -t\n");
+      exit(-1);
+    }
+
+  if(tr->batch && tr->expand)
+    {
+      printf("Usage error -E can not be combined with the batch mode -b, which prints the factorizations\n");
+      exit(-1);
+    }
+
+  if(tr->batch && !constraintSet)
+    {
+      printf("Usage error the batch mode -b counts the trees of a tree collection passed via -t\n");
+      exit(-1);
+    }
+
+  if(tr->unique && (tr->countOnly || tr->format == FORMAT_RAW))
+    {
+      printf("Usage error -u compares the tree data structures and can neither be combined with -c nor with the raw output format\n");
+      exit(-1);
+    }
+
+  return;
+}
+
+
+static void computeNumberOfTrees(tree *tr)
+{
+   mpz_t 
+      integ;  
+   
+   char
+     what[256];
+
+#ifdef HAVE_INT128
+   uint128
+     unrooted,
+     rooted;
+#endif
+
+   if(tr->factored)
+     {
+       primeExponents
+	 f;
+
+       initPrimeExponents(&f, (unsigned long int)(2 * tr->mxtips));
+
+       addOddDoubleFactorialExponents(&f, (unsigned long int)(tr->mxtips - 2), 1);
+
+       sprintf(what, "Number of unrooted binary trees for %d taxa", tr->mxtips);
+       printFactoredCount(tr, what, "unrooted", (long long)tr->mxtips, &f);
+
+       addFactorExponents(&f, (unsigned long int)(2 * tr->mxtips - 3));
+
+       sprintf(what, "Number of rooted binary trees for %d taxa", tr->mxtips);
+       printFactoredCount(tr, what, "rooted", (long long)tr->mxtips, &f);
+
+       freePrimeExponents(&f);
+
+       return;
+     }
+
+#ifdef HAVE_INT128
+   if(oddProduct128(&unrooted, 1, (unsigned long int)(2 * tr->mxtips - 5)))
+     {
+       rooted = unrooted;
+
+       if(multiply128(&rooted, (uint128)(2 * tr->mxtips - 3)))
+	 {
+	   sprintf(what, "Number of unrooted binary trees for %d taxa", tr->mxtips);
+	   printCount128(tr, what, "unrooted", (long long)tr->mxtips, -1, unrooted);
+
+	   sprintf(what, "Number of rooted binary trees for %d taxa", tr->mxtips);
+	   printCount128(tr, what, "rooted", (long long)tr->mxtips, -1, rooted);
+
+	   return;
+	 }
+     }
+#endif
+
+   mpz_init(integ);
+
+   /* (2n - 5)!! unrooted trees, the factors are 1, 1, 3, 5, ..., 2n - 5 for n = 3 ... */
+
+   oddDoubleFactorial(integ, (unsigned long int)(2 * tr->mxtips - 5), tr->threads);
+   
+   sprintf(what, "Number of unrooted binary trees for %d taxa", tr->mxtips);
+   printCount(tr, what, "unrooted", (long long)tr->mxtips, -1, integ);
+   
+   mpz_mul_ui(integ, integ, (unsigned long int)(2 * (tr->mxtips + 1) - 5));
+
+   sprintf(what, "Number of rooted binary trees for %d taxa", tr->mxtips);
+   printCount(tr, what, "rooted", (long long)tr->mxtips, -1, integ);
+
+   mpz_clear(integ);
+}
+
+
+/* 
+   -n from:to[:stride]: one row per number of taxa, the unrooted count is 
+   updated by the product of the odd factors between two rows and every 
+   row is streamed out as soon as it is known. With -a the rows only 
+   contain the certified leading digits and take constant time each.
+*/
+
+static void tabulateNumberOfTrees(tree *tr)
+{
+  long long
+    n;
+
+  mpz_t
+    unrooted,
+    rooted,
+    step;
+
+  logAccumulator
+    a;
+
+  logInterval
+    r;
+
+  char
+    u[96],
+    v[96];
+
+  if(tr->format == FORMAT_DEC || tr->format == FORMAT_HEX)
+    fprintf(countFile, "taxa\tunrooted\trooted\n");
+
+  if(tr->approximate)
+    {
+      for(n = tr->rangeFrom; ; n += tr->rangeStride)
+	{
+	  initLogAccumulator(&a);
+	  addLogOddDoubleFactorial(&a, (unsigned long int)(n - 2), 1);
+	  logAccumulatorInterval(&a, &r);
+	  formatApproximateCount(&r, u);
+
+	  initLogAccumulator(&a);
+	  addLogOddDoubleFactorial(&a, (unsigned long int)(n - 2), 1);
+	  addLogFactor(&a, (unsigned long int)(2 * n - 3));
+	  logAccumulatorInterval(&a, &r);
+	  formatApproximateCount(&r, v);
+
+	  fprintf(countFile, "%lld\t%s\t%s\n", n, u, v);
+
+	  if(tr->numTaxa - n < tr->rangeStride)
+	    break;
+	}
+
+      return;
+    }
+
+  mpz_init(unrooted);
+  mpz_init(rooted);
+  mpz_init(step);
+
+  oddDoubleFactorial(unrooted, (unsigned long int)(2 * tr->rangeFrom - 5), tr->threads);
+
+  for(n = tr->rangeFrom; ; n += tr->rangeStride)
+    {
+      mpz_mul_ui(rooted, unrooted, (unsigned long int)(2 * n - 3));
+
+      switch(tr->format)
+	{
+	case FORMAT_RAW:
+	  mpz_out_raw(countFile, unrooted);
+	  mpz_out_raw(countFile, rooted);
+	  break;
+	case FORMAT_JSON:
+	  fprintf(countFile, "{\"taxa\": %lld, \"unrooted\": \"", n);
+	  mpz_out_str(countFile, 10, unrooted);
+	  fprintf(countFile, "\", \"rooted\": \"");
+	  mpz_out_str(countFile, 10, rooted);
+	  fprintf(countFile, "\"}\n");
+	  break;
+	case FORMAT_HEX:
+	  fprintf(countFile, "%lld\t0x", n);
+	  mpz_out_str(countFile, 16, unrooted);
+	  fprintf(countFile, "\t0x");
+	  mpz_out_str(countFile, 16, rooted);
+	  fprintf(countFile, "\n");
+	  break;
+	default:
+	  fprintf(countFile, "%lld\t", n);
+	  mpz_out_str(countFile, 10, unrooted);
+	  fprintf(countFile, "\t");
+	  mpz_out_str(countFile, 10, rooted);
+	  fprintf(countFile, "\n");
+	}
+
+      if(tr->numTaxa - n < tr->rangeStride)
+	break;
+
+      /* (2(n + s) - 5)!! = (2n - 5)!! (2n - 3) (2n - 1) ... (2(n + s) - 5) */
+
+      oddProduct(step, (unsigned long int)(2 * n - 3), (unsigned long int)(2 * (n + tr->rangeStride) - 5));
+      mpz_mul(unrooted, unrooted, step);
+    }
+
+  mpz_clear(unrooted);
+  mpz_clear(rooted);
+  mpz_clear(step);
+}
+
+static boolean printConstraintResult(tree *tr)
+{
+  if(!tr->batch && !tr->multiFile)
+    printf("\nFound a total of %d taxa in constraint tree %s\n", tr->ntips, tr->fileName);
+
+  if(tr->ntips < 4)
+    {    
+      fprintf(tr->messageFile, "TOO FEW SPECIES, tree contains only %d species\n", tr->ntips);
+      return FALSE;
+    }
+
+  printHistogramCount(tr->histogram, tr);
+
+  return TRUE;
+}
+
+/* 
+   counts every distinct topology of a collection once, the row of a new 
+   topology is written into memory and all rows are printed at the end 
+   with the number of copies appended
+*/
+
+static boolean countUniqueTrees(treeReader *rd, tree *tr)
+{
+  FILE
+    *rowFile = tr->rowFile;
+
+  topologySet
+    *s;
+
+  topologyEntry
+    *e;
+
+  int
+    ch,
+    i;
+
+  boolean 
+    found,
+    success;
+
+  if(tr->topologies == (topologySet *)NULL)
+    tr->topologies = initTopologySet();
+  else
+    clearTopologySet(tr->topologies);
+
+  s = tr->topologies;
+
+  for(tr->treeIndex = 1; ; tr->treeIndex++)
+    {
+      if((ch = treeGetCh(rd)) == EOF)
+	break;
+
+      readerUngetc(ch, rd);
+
+      if(!readConstraintTree(rd, tr))
 	{
-	  c = fgetc(f);
-	  if(c ==  '(' || c == ',')
-	    ungetc(c, f);
-	  else
-	    {	      
-	      i = 0;	      	     
-	      
-	      do
-		{
-		  buffer[i++] = c;
-		  c = fgetc(f);
-		}
-	      while(c != ':' && c != ')' && c != ',');
-	      buffer[i] = '\0';	    
+	  fprintf(tr->messageFile, "ERROR: Unable to count tree %lld of tree collection %s\n", tr->treeIndex, tr->fileName);
+	  return FALSE;
+	}
 
-	      for(i = 0; i < taxaCount; i++)
-		{
-		  if(strcmp(buffer, nameList[i]) == 0)
-		    {
-		      printf("A taxon labelled by %s appears twice in the first tree of tree collection %s, exiting ...\n", buffer, fileName);
-		      exit(-1);
-		    }
-		}	     
-	     
-	      if(taxaCount == taxaSize)
-		{		  
-		  taxaSize *= 2;
-		  nameList = (char **)realloc(nameList, sizeof(char*) * taxaSize);		 
-		}
-	      
-	      nameList[taxaCount] = (char*)malloc(sizeof(char) * (strlen(buffer) + 1));
-	      strcpy(nameList[taxaCount], buffer);
-	     
-	      taxaCount++;
-			    
-	      ungetc(c, f);
-	    }
-	}   
+      canonicalTopology(tr, s);
+
+      e = findTopology(s, &found);
+
+      if(found)
+	{
+	  e->copies++;
+	  continue;
+	}
+
+      tr->rowFile = open_memstream(&(e->row), &(e->rowLength));
+      assert(tr->rowFile);
+
+      success = printConstraintResult(tr);
+
+      fclose(tr->rowFile);
+      tr->rowFile = rowFile;
+
+      if(!success)
+	{
+	  fprintf(tr->messageFile, "ERROR: Unable to count tree %lld of tree collection %s\n", tr->treeIndex, tr->fileName);
+	  return FALSE;
+	}
     }
-  
-  printf("\nFound a total of %d taxa in constraint tree %s\n", taxaCount, fileName);
- 
 
-  tr->detectedTips = taxaCount;
+  /* every row ends with a newline, a JSON row with } and a newline */
 
-  tr->nameList = (char **)malloc(sizeof(char *) * (taxaCount + 1));  
-  for(i = 1; i <= taxaCount; i++)
-    tr->nameList[i] = nameList[i - 1];
-  
-  free(nameList);
+  for(i = 0; i < s->entries; i++)
+    {
+      e = &(s->entry[i]);
+
+      if(tr->format == FORMAT_JSON)
+	fprintf(rowFile, "%.*s, \"copies\": %lld}\n", (int)(e->rowLength - 2), e->row, e->copies);
+      else
+	fprintf(rowFile, "%.*s\t%lld\n", (int)(e->rowLength - 1), e->row, e->copies);
+    }
 
+  if(!tr->multiFile)
+    printf("\nCounted %lld trees with %d distinct topologies in tree collection %s\n\n", tr->treeIndex - 1, s->entries, tr->fileName);
 
+  return TRUE;
+}
 
-  if(taxaCount < 4)
-    {    
-      printf("TOO FEW SPECIES, tree contains only %d species\n", taxaCount);
-      assert(0);
+/* 
+   counts every tree of a collection, e.g., of a bootstrap file, one after 
+   the other, the trees may be defined on different sets of taxa. The hash 
+   table, the topology and the scratch buffers of the first tree are reused 
+   for all further trees.
+*/
+
+static boolean countTreeCollection(treeReader *rd, tree *tr)
+{
+  int
+    ch;
+
+  boolean 
+    success;
+
+  reportProducts = FALSE;
+
+  if(!tr->multiFile)
+    printRowHeader(tr);
+
+  if(tr->unique)
+    return countUniqueTrees(rd, tr);
+
+  for(tr->treeIndex = 1; ; tr->treeIndex++)
+    {
+      /* white space and comments may follow the last tree */
+
+      if((ch = treeGetCh(rd)) == EOF)
+	break;
+
+      readerUngetc(ch, rd);
+
+      success = readConstraintTree(rd, tr) && printConstraintResult(tr);
+
+      if(!success)
+	{
+	  fprintf(tr->messageFile, "ERROR: Unable to count tree %lld of tree collection %s\n", tr->treeIndex, tr->fileName);
+	  return FALSE;
+	}
     }
 
-  tr->nameHash = initStringHashTable(10 * taxaCount);
-  for(i = 1; i <= taxaCount; i++)
-    addword(tr->nameList[i], tr->nameHash, i);
+  if(!tr->multiFile)
+    printf("\nCounted %lld trees in tree collection %s\n\n", tr->treeIndex - 1, tr->fileName);
 
-  fclose(f);
+  return TRUE;
+}
+
+static boolean countTreeFile(tree *tr)
+{
+  boolean 
+    success;
+
+  treeReader 
+    rd;
+
+  /* "-" denotes standard input, since the tree is only read once it may also be a pipe */
+
+  if(!openTreeReader(&rd, tr->fileName))
+    {
+      fprintf(tr->messageFile, "ERROR: Unable to open constraint tree file %s\n", tr->fileName);
+      return FALSE;
+    }
+
+  rd.messages = tr->messageFile;
+
+  if(tr->batch)
+    success = countTreeCollection(&rd, tr);
+  else
+    success = readConstraintTree(&rd, tr) && printConstraintResult(tr);
+
+  closeTreeReader(&rd);
+
+  return success;
 }
 
+/* 
+   many constraint tree files are counted by a pool of threads, each with 
+   its own tree context, i.e., hash table, topology and scratch buffers. 
+   Every worker owns a deque of files that is dealt out round robin, a 
+   worker whose deque runs empty steals from the others. Owners and 
+   thieves both take the file with the smallest index such that the files 
+   complete roughly in input order. The rows of a file are written into 
+   memory together with the error messages of the file and the main 
+   thread writes them in input order, a worker does 
+   not start a file that is more than REORDER_WINDOW files ahead of the 
+   output, which bounds the memory of the reorder buffer.
+*/
 
-int *partA;
-int partCount = 0;
-char treeFileName[2048] = "";
+#define REORDER_WINDOW_PER_THREAD 64
 
-static void hookupDefault (nodeptr p, nodeptr q)
+typedef struct
 {
-  p->back = q;
-  q->back = p;
+  int             *files;
+  int              head;
+  int              tail;
+  pthread_mutex_t  mutex;
 }
+  fileDeque;
 
+typedef struct
+{
+  char            *text;
+  size_t           length;
+  char            *messages;
+  size_t           messageLength;
+  boolean          done;
+  boolean          failed;
+}
+  fileResult;
 
-static boolean  addElementLenMULT (FILE *fp, tree *tr, nodeptr p)
-{ 
-  nodeptr  q, r, s;
-  int      n, ch, fres, rn;
-  double randomResolution;
-  int old;   
+typedef struct
+{
+  tree            *options;
+  fileDeque       *deques;
+  fileResult      *results;
+  int              workers;
+  int              written;
+  int              window;
+  pthread_mutex_t  mutex;
+  pthread_cond_t   finished;
+  pthread_cond_t   progress;
+}
+  filePool;
 
-  if ((ch = treeGetCh(fp)) == '(') 
-    {     
-      partCount++;
-      old = partCount;      
+typedef struct
+{
+  filePool        *pool;
+  int              id;
+}
+  fileWorker;
 
-      partA[partCount] = partA[partCount] + 2;
-      
-      n = (tr->nextnode)++;
-      if (n > 2*(tr->mxtips) - 2) 
+static int takeTreeFile(filePool *pool, int id)
+{
+  int
+    i,
+    f = -1;
+
+  for(i = 0; i < pool->workers && f < 0; i++)
+    {
+      fileDeque
+	*d = &(pool->deques[(id + i) % pool->workers]);
+
+      pthread_mutex_lock(&(d->mutex));
+      if(d->head < d->tail)
+	f = d->files[d->head++];
+      pthread_mutex_unlock(&(d->mutex));
+    }
+
+  if(f < 0)
+    return f;
+
+  /* backpressure of the reorder buffer */
+
+  pthread_mutex_lock(&(pool->mutex));
+  while(f >= pool->written + pool->window)
+    pthread_cond_wait(&(pool->progress), &(pool->mutex));
+  pthread_mutex_unlock(&(pool->mutex));
+
+  return f;
+}
+
+
+static void *treeFileWorker(void *arg)
+{
+  fileWorker
+    *w = (fileWorker *)arg;
+
+  filePool
+    *pool = w->pool;
+
+  tree
+    tr = *(pool->options);
+
+  int 
+    f;
+
+  fileResult
+    r;
+
+  /* a private context, the threads go to the files and not into the products */
+
+  tr.threads    = 1;
+  tr.nameHash   = (stringHashtable *)NULL;
+  tr.histogram  = (degreeHistogram *)NULL;
+  tr.topologies = (topologySet *)NULL;
+  tr.scanIndex  = (uint32_t *)NULL;
+  tr.childCount = (int *)NULL;
+
+  while((f = takeTreeFile(pool, w->id)) >= 0)
+    {
+      r.text          = (char *)NULL;
+      r.length        = 0;
+      r.messages      = (char *)NULL;
+      r.messageLength = 0;
+      r.done          = TRUE;
+
+      tr.fileName    = tr.fileNames[f];
+      tr.rowFile     = open_memstream(&(r.text), &(r.length));
+      tr.messageFile = open_memstream(&(r.messages), &(r.messageLength));
+      assert(tr.rowFile && tr.messageFile);
+
+      r.failed = !countTreeFile(&tr);
+
+      if(r.failed)
+	fprintf(tr.messageFile, "ERROR: Unable to count constraint tree file %s\n", tr.fileName);
+
+      fclose(tr.rowFile);
+      fclose(tr.messageFile);
+
+      pthread_mutex_lock(&(pool->mutex));
+      pool->results[f] = r;
+      pthread_cond_signal(&(pool->finished));
+      pthread_mutex_unlock(&(pool->mutex));
+    }
+
+  freeTreeContext(&tr);
+
+  return (void *)NULL;
+}
+
+static boolean countTreeFiles(tree *tr)
+{
+  filePool
+    pool;
+
+  fileWorker
+    *w;
+
+  pthread_t
+    *threads;
+
+  int
+    i,
+    failed = 0,
+    started = 0,
+    workers = (tr->threads < tr->fileCount) ? tr->threads : tr->fileCount;
+
+  reportProducts = FALSE;
+
+  pool.options  = tr;
+  pool.workers  = workers;
+  pool.written  = 0;
+  pool.window   = REORDER_WINDOW_PER_THREAD * workers;
+  pool.deques   = (fileDeque *)malloc(sizeof(fileDeque) * workers);
+  pool.results  = (fileResult *)calloc((size_t)tr->fileCount, sizeof(fileResult));
+  w             = (fileWorker *)malloc(sizeof(fileWorker) * workers);
+  threads       = (pthread_t *)malloc(sizeof(pthread_t) * workers);
+
+  assert(pool.deques && pool.results && w && threads);
+
+  pthread_mutex_init(&(pool.mutex), (pthread_mutexattr_t *)NULL);
+  pthread_cond_init(&(pool.finished), (pthread_condattr_t *)NULL);
+  pthread_cond_init(&(pool.progress), (pthread_condattr_t *)NULL);
+
+  for(i = 0; i < workers; i++)
+    {
+      pool.deques[i].files = (int *)malloc(sizeof(int) * (tr->fileCount / workers + 1));
+      pool.deques[i].head  = 0;
+      pool.deques[i].tail  = 0;
+      pthread_mutex_init(&(pool.deques[i].mutex), (pthread_mutexattr_t *)NULL);
+    }
+
+  for(i = 0; i < tr->fileCount; i++)
+    {
+      fileDeque
+	*d = &(pool.deques[i % workers]);
+
+      d->files[d->tail++] = i;
+    }
+
+  printRowHeader(tr);
+
+  /* the workers steal from each other, the started ones count all files */
+
+  for(i = 0; i < workers; i++, started++)
+    {
+      w[i].pool = &pool;
+      w[i].id   = i;
+
+      if(pthread_create(&threads[i], (pthread_attr_t *)NULL, treeFileWorker, (void *)&w[i]) != 0)
+	break;
+    }
+
+  if(started == 0)
+    {
+      printf("ERROR: Unable to start a thread for the constraint tree files\n");
+      failed = tr->fileCount;
+    }
+
+  /* the reorder buffer, the rows are written in the order of the files */
+
+  for(i = 0; i < tr->fileCount && started > 0; i++)
+    {
+      fileResult
+	*r = &(pool.results[i]);
+
+      pthread_mutex_lock(&(pool.mutex));
+      while(!r->done)
+	pthread_cond_wait(&(pool.finished), &(pool.mutex));
+      pthread_mutex_unlock(&(pool.mutex));
+
+      fwrite(r->text, 1, r->length, countFile);
+      free(r->text);
+
+      /* the messages of a file follow its rows, both may go to standard output */
+
+      if(r->messageLength > 0)
+	{
+	  fflush(countFile);
+	  fwrite(r->messages, 1, r->messageLength, stdout);
+	  fflush(stdout);
+	}
+
+      free(r->messages);
+
+      if(r->failed)
+	failed++;
+
+      pthread_mutex_lock(&(pool.mutex));
+      pool.written = i + 1;
+      pthread_cond_broadcast(&(pool.progress));
+      pthread_mutex_unlock(&(pool.mutex));
+    }
+
+  for(i = 0; i < workers; i++)
+    {
+      if(i < started)
+	pthread_join(threads[i], (void **)NULL);
+      free(pool.deques[i].files);
+      pthread_mutex_destroy(&(pool.deques[i].mutex));
+    }
+
+  pthread_mutex_destroy(&(pool.mutex));
+  pthread_cond_destroy(&(pool.finished));
+  pthread_cond_destroy(&(pool.progress));
+
+  free(pool.deques);
+  free(pool.results);
+  free(w);
+  free(threads);
+
+  printf("\nCounted %d constraint tree files with %d threads", tr->fileCount - failed, started);
+  if(failed > 0)
+    printf(", %d files could not be counted", failed);
+  printf("\n\n");
+
+  return (failed == 0);
+}
+
+/* 
+   server mode -S socketFileName: the requests of a connection over a Unix 
+   domain socket are answered in order by one of the -T worker threads, 
+   each of which keeps a library context, i.e., the taxon hash table and 
+   the tree buffers, and its GMP result for all requests. A request is 
+   either a line
+
+     n numberOfTaxa [rooted]
+
+   or a line 
+
+     tree numberOfBytes 
+
+   followed by that many bytes of a Newick tree. Empty lines between the 
+   requests, e.g., a newline after the tree, are ignored. Every request is 
+   answered by one line
+
+     ok taxa maxMultifurcation rooted count
+     error reason: message
+
+   Accepted connections wait in a queue of SERVER_QUEUE_PER_THREAD entries 
+   per thread, while the queue is full no further connections are accepted 
+   and clients wait in the listen backlog of the same size. A connection 
+   that is idle for SERVER_IDLE_SECONDS, or whose client does not read the 
+   answers for as long, is closed. While the queue is full the stop flag 
+   is checked every SERVER_POLL_SECONDS.
+*/
+
+#define SERVER_QUEUE_PER_THREAD 4
+#define SERVER_IDLE_SECONDS     60
+#define SERVER_POLL_SECONDS     1
+#define SERVER_INPUT_SIZE       (1 << 16)
+#define SERVER_MAX_LINE         256
+#define SERVER_MAX_TREE_BYTES   ((size_t)1 << 30)
+
+typedef struct
+{
+  int             *connections;
+  int              capacity;
+  int              head;
+  int              count;
+  int              flags;
+  pthread_mutex_t  mutex;
+  pthread_cond_t   notEmpty;
+  pthread_cond_t   notFull;
+}
+  serverQueue;
+
+typedef struct
+{
+  serverQueue        *queue;
+  treeCounterContext *context;
+  treeCounterResult   result;
+  char               *input;
+  size_t              length;
+  size_t              position;
+  char               *tree;
+  size_t              treeSize;
+}
+  serverWorker;
+
+static volatile sig_atomic_t serverStop = 0;
+
+static void stopServer(int signal)
+{
+  (void) signal;
+
+  serverStop = 1;
+}
+
+static boolean serverFill(serverWorker *w, int fd)
+{
+  ssize_t 
+    n;
+
+  if(w->position > 0)
+    {
+      memmove(w->input, &(w->input[w->position]), w->length - w->position);
+      w->length  -= w->position;
+      w->position = 0;
+    }
+
+  do
+    n = read(fd, &(w->input[w->length]), SERVER_INPUT_SIZE - w->length);
+  while(n < 0 && errno == EINTR);
+
+  if(n <= 0)
+    return FALSE;
+
+  w->length += (size_t)n;
+
+  return TRUE;
+}
+
+static boolean serverReadLine(serverWorker *w, int fd, char *line)
+{
+  char 
+    *end;
+
+  size_t 
+    k;
+
+  for(;;)
+    {
+      end = (char *)memchr(&(w->input[w->position]), '\n', w->length - w->position);
+
+      if(end)
+	{
+	  k = (size_t)(end - &(w->input[w->position]));
+	  if(k >= SERVER_MAX_LINE)
+	    return FALSE;
+
+	  memcpy(line, &(w->input[w->position]), k);
+	  if(k > 0 && line[k - 1] == '\r')
+	    k--;
+	  line[k] = '\0';
+
+	  w->position += (size_t)(end - &(w->input[w->position])) + 1;
+
+	  return TRUE;
+	}
+
+      if(w->length - w->position >= SERVER_MAX_LINE || !serverFill(w, fd))
+	return FALSE;
+    }
+}
+
+static boolean serverReadBytes(serverWorker *w, int fd, char *b, size_t n)
+{
+  size_t 
+    k;
+
+  while(n > 0)
+    {
+      if(w->position == w->length && !serverFill(w, fd))
+	return FALSE;
+
+      k = w->length - w->position;
+      if(k > n)
+	k = n;
+
+      memcpy(b, &(w->input[w->position]), k);
+
+      b           += k;
+      n           -= k;
+      w->position += k;
+    }
+
+  return TRUE;
+}
+
+/* the messages of the library may span several lines */
+
+static void serverReplyError(FILE *out, int status, const char *message)
+{
+  size_t 
+    length = strlen(message);
+
+  while(length > 0 && isspace((unsigned char)message[length - 1]))
+    length--;
+
+  fprintf(out, "error %s: ", treeCounterStatusString(status));
+
+  for(; length > 0; length--, message++)
+    fputc((*message == '\n') ? ' ' : *message, out);
+
+  fputc('\n', out);
+}
+
+static void serveConnection(serverWorker *w, int fd)
+{
+  FILE 
+    *out = fdopen(fd, "w");
+
+  char 
+    line[SERVER_MAX_LINE],
+    word[SERVER_MAX_LINE];
+
+  long long 
+    n;
+
+  unsigned long long
+    bytes;
+
+  int 
+    fields,
+    status;
+
+  if(!out)
+    {
+      close(fd);
+      return;
+    }
+
+  w->length   = 0;
+  w->position = 0;
+
+  while(serverReadLine(w, fd, line))
+    {
+      if(line[strspn(line, " \t")] == '\0')
+	continue;
+
+      if((fields = sscanf(line, "n %lld %255s", &n, word)) >= 1)
 	{
-	  if (tr->rooted || n > 2*(tr->mxtips) - 1) 
+	  if(fields == 2 && strcmp(word, "rooted") != 0)
 	    {
-	      printf("ERROR: Too many internal nodes.  Is tree rooted?\n");
-	      printf("       Deepest splitting should be a trifurcation.\n");
-	      return FALSE;
+	      serverReplyError(out, TREE_COUNTER_ARGUMENT_ERROR, "unknown request");
+	      status = -1;
 	    }
-	  else 
+	  else
+	    status = treeCounterCountTaxa(w->context, n, (fields == 2), &(w->result));
+	}
+      else if(sscanf(line, "tree %llu", &bytes) == 1)
+	{
+	  if(bytes > SERVER_MAX_TREE_BYTES)
 	    {
-	      tr->rooted = TRUE;	    
+	      serverReplyError(out, TREE_COUNTER_TOO_LARGE, "the tree exceeds the request size limit");
+	      break;
 	    }
-	}
-      q = tr->nodep[n];
-     
-      if (! addElementLenMULT(fp, tr, q->next))        return FALSE;
-      if (! treeNeedCh(fp, ',', "in"))             return FALSE;
-      if (! addElementLenMULT(fp, tr, q->next->next))  return FALSE;
-                 
-      hookupDefault(p, q);
-
-      while((ch = treeGetCh(fp)) == ',')
-	{ 	 
-	  partA[old] = partA[old] + 1; 
 
-	  n = (tr->nextnode)++;
-	  if (n > 2*(tr->mxtips) - 2) 
+	  if(bytes > w->treeSize)
 	    {
-	      if (tr->rooted || n > 2*(tr->mxtips) - 1) 
-		{
-		  printf("ERROR: Too many internal nodes.  Is tree rooted?\n");
-		  printf("       Deepest splitting should be a trifurcation.\n");
-		  return FALSE;
-		}
-	      else 
-		{
-		  tr->rooted = TRUE;
-		}
+	      w->treeSize = (size_t)bytes;
+	      w->tree     = (char *)realloc(w->tree, w->treeSize);
+	      assert(w->tree);
 	    }
-	  r = tr->nodep[n];
-	 
-
-	  rn = randomInt(10000);
-	  if(rn == 0) 
-	    randomResolution = 0;
-	  else 
-	    randomResolution = ((double)rn)/10000.0;
-	   	  
-	   if(randomResolution < 0.5)
-	    {	    
-	      s = q->next->back;	      
-	      r->back = q->next;
-	      q->next->back = r;	      
-	      r->next->back = s;
-	      s->back = r->next;	      
-	      addElementLenMULT(fp, tr, r->next->next);	     
-	    }
-	  else
-	    {	  
-	      s = q->next->next->back;	      
-	      r->back = q->next->next;
-	      q->next->next->back = r;	      
-	      r->next->back = s;
-	      s->back = r->next;	      
-	      addElementLenMULT(fp, tr, r->next->next);	     
-	    }	    	  	  
-	}            
 
-      if(ch != ')')
+	  if(!serverReadBytes(w, fd, w->tree, (size_t)bytes))
+	    break;
+
+	  status = treeCounterCountBuffer(w->context, w->tree, (size_t)bytes, &(w->result));
+	}
+      else
 	{
-	  printf("Missing /) in treeReadLenMULT\n");
-	  exit(-1);	        
+	  serverReplyError(out, TREE_COUNTER_ARGUMENT_ERROR, "unknown request");
+	  status = -1;
 	}
-	
 
+      if(status == TREE_COUNTER_OK)
+	{
+	  fprintf(out, "ok %lld %d %d ", w->result.taxa, w->result.maxMultifurcation, w->result.rooted);
+	  mpz_out_str(out, 10, w->result.count);
+	  fputc('\n', out);
+	}
+      else if(status > 0)
+	serverReplyError(out, status, treeCounterErrorMessage(w->context));
 
-      (void) treeFlushLabel(fp);
-    }
-  else 
-    {                             
-      ungetc(ch, fp);
-      if ((n = treeFindTipName(fp, tr)) <= 0)          return FALSE;
-      q = tr->nodep[n];         
+      /* answers are sent per request, a client may already wait for them */
 
-      if (tr->start->number > n)  tr->start = q;
-      (tr->ntips)++;
-      hookupDefault(p, q);
+      if(fflush(out) != 0)
+	break;
     }
-  
-  fres = treeFlushLen(fp);
-  if(!fres) return FALSE;
-    
-  return TRUE;          
-} 
-
-
-static size_t numTrees(int taxa)
-{
-  size_t 
-    i,
-    t = (size_t)taxa,
-    p = 1;
-
-  for(i = 3; i <= t; i++)
-    p = p * (2 * i - 3);
-
-  return p;
 
+  fclose(out);
 }
 
-
-static boolean treeReadLenMULT (FILE *fp, tree *tr)
+static void *serverWorkerThread(void *arg)
 {
-  nodeptr  p, r, s;
-  int      i, ch, n, rn;
-  double randomResolution;
-
-  srand((unsigned int) time(NULL));
-  
-  partA = (int*)calloc(tr->mxtips, sizeof(int));
-
-  for (i = 1; i <= tr->mxtips; i++) 
-    tr->nodep[i]->back = (node *) NULL;
+  serverWorker
+    *w = (serverWorker *)arg;
 
-  for(i = tr->mxtips + 1; i < 2 * tr->mxtips; i++)
-    {
-      tr->nodep[i]->back = (nodeptr)NULL;
-      tr->nodep[i]->next->back = (nodeptr)NULL;
-      tr->nodep[i]->next->next->back = (nodeptr)NULL;
-      tr->nodep[i]->number = i;
-      tr->nodep[i]->next->number = i;
-      tr->nodep[i]->next->next->number = i;
-    }
-
-
-  tr->start       = tr->nodep[tr->mxtips];
-  tr->ntips       = 0;
-  tr->nextnode    = tr->mxtips + 1;  
+  serverQueue
+    *q = w->queue;
 
-  tr->rooted      = FALSE;
- 
-  p = tr->nodep[(tr->nextnode)++]; 
-  while((ch = treeGetCh(fp)) != '(');
-      
-  if (! addElementLenMULT(fp, tr, p))                 return FALSE;
-  if (! treeNeedCh(fp, ',', "in"))                return FALSE;
-  if (! addElementLenMULT(fp, tr, p->next))           return FALSE;
-  if (! tr->rooted) 
-    {
-      if ((ch = treeGetCh(fp)) == ',') 
-	{       
-	  if (! addElementLenMULT(fp, tr, p->next->next)) return FALSE;
-
-	  while((ch = treeGetCh(fp)) == ',')
-	    { 
-	      n = (tr->nextnode)++;
-	      assert(n <= 2*(tr->mxtips) - 2);
-	
-	      r = tr->nodep[n];	
-	     	   
-	      
-	      rn = randomInt(10000);
-	      if(rn == 0) 
-		randomResolution = 0;
-	      else 
-		randomResolution = ((double)rn)/10000.0;
+  int 
+    fd;
 
-	      printf("TOP-LEVEL MULTI\n");
-	      assert(0);
+  w->context  = treeCounterCreate(1, q->flags);
+  w->input    = (char *)malloc(SERVER_INPUT_SIZE);
+  w->tree     = (char *)NULL;
+  w->treeSize = 0;
 
+  assert(w->context && w->input);
 
-	      if(randomResolution < 0.5)
-		{	
-		  s = p->next->next->back;		  
-		  r->back = p->next->next;
-		  p->next->next->back = r;		  
-		  r->next->back = s;
-		  s->back = r->next;		  
-		  addElementLenMULT(fp, tr, r->next->next);	
-		}
-	      else
-		{
-		  s = p->next->back;		  
-		  r->back = p->next;
-		  p->next->back = r;		  
-		  r->next->back = s;
-		  s->back = r->next;		  
-		  addElementLenMULT(fp, tr, r->next->next);
-		}
-	    }	  	  	      	  
+  treeCounterInitResult(&(w->result));
 
-	  if(ch != ')')
-	    {
-	      printf("Missing /) in treeReadLenMULT\n");
-	      exit(-1);	        	      	      
-	    }
-	  else
-	    ungetc(ch, fp);
-	}
-      else 
-	{ 
-	  tr->rooted = TRUE;
-	  if (ch != EOF)  (void) ungetc(ch, fp);
-	}       
-    }
-  else 
+  for(;;)
     {
-      p->next->next->back = (nodeptr) NULL;
+      pthread_mutex_lock(&(q->mutex));
+      while(q->count == 0)
+	pthread_cond_wait(&(q->notEmpty), &(q->mutex));
+      fd = q->connections[q->head];
+      q->head = (q->head + 1) % q->capacity;
+      q->count--;
+      pthread_cond_signal(&(q->notFull));
+      pthread_mutex_unlock(&(q->mutex));
+
+      serveConnection(w, fd);
     }
-    
-  if (! treeNeedCh(fp, ')', "in"))                return FALSE;
-  (void) treeFlushLabel(fp);
-  if (! treeFlushLen(fp))                         return FALSE;
-   
-  if (! treeNeedCh(fp, ';', "at end of"))       return FALSE;
-  
-
-  assert(tr->ntips == tr->mxtips);
-     
-  {
-    mpz_t 
-      integ,
-      treeNum;
 
-    int 
-      n,
-      max = 0;
-    
-    char 
-      *b = (char*)NULL;
-    
-    mpz_init(integ);
-    mpz_init(treeNum);
+  return (void *)NULL;
+}
 
-    mpz_set_ui(integ, 1);
+static boolean runServer(tree *tr)
+{
+  struct sockaddr_un 
+    address;
 
-    for(i = 0; i < tr->mxtips; i++)
-      {
-	if(partA[i] > 2)
-	  {
-	    /*printf("K %d %Zu\n", partA[i], numTrees(partA[i]));*/
+  struct sigaction
+    action;
 
-	    if(partA[i] > max)	      
-	      max = partA[i];	      	     
-	
-	    mpz_set_ui(treeNum, (unsigned long int)(numTrees(partA[i])));
+  struct timeval
+    idle;
 
-	    mpz_mul(integ, integ, treeNum);	     	   
-	  }
-		       
+  struct stat
+    st;
 
-	
-      }
-   
-      
-    printf("\n\nMaximum size unresolved multifurcation has %d taxa\n\n", max);
+  serverQueue
+    q;
 
-    b = mpz_get_str (b, 10, integ);
-      
-    printf("Number of unrooted binary trees under this constraint: %s\n\n", b);
-    
-    n = strlen(b);
+  serverWorker
+    *workers;
 
-    if(n > 3)            
-      printf("Approximately %c.%c%c times 10^%d\n\n\n", b[0], b[1], b[2], n - 1);   
+  struct timespec
+    deadline;
 
-    free(b);       
-  }
- 
-  return TRUE; 
-}
+  sigset_t
+    stopSignals,
+    previous;
 
+  pthread_t
+    thread;
 
-static int mygetopt(int argc, char **argv, char *opts, int *optind, char **optarg)
-{
-  static int sp = 1;
-  register int c;
-  register char *cp;
+  int
+    i,
+    fd,
+    probeFd,
+    listenFd;
 
-  if(sp == 1)
-    {
-      if(*optind >= argc || argv[*optind][0] != '-' || argv[*optind][1] == '\0')
-	return -1;
-    }
-  else
+  if(strlen(socketFileName) >= sizeof(address.sun_path))
     {
-      if(strcmp(argv[*optind], "--") == 0)
-	{
-	  *optind =  *optind + 1;
-	  return -1;
-	}
+      printf("ERROR: The socket file name %s is too long\n", socketFileName);
+      return FALSE;
     }
 
-  c = argv[*optind][sp];
-  if(c == ':' || (cp=strchr(opts, c)) == 0)
-    {
-      printf(": illegal option -- %c \n", c);
-      if(argv[*optind][++sp] == '\0')
-	{
-	  *optind =  *optind + 1;
-	  sp = 1;
-	}
-      return('?');
-    }
-  if(*++cp == ':')
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socketFileName);
+
+  /* 
+     a stale socket of a previous server, i.e., one that refuses connections, 
+     is replaced, the socket of a running server and any other file are kept 
+  */
+
+  if(stat(socketFileName, &st) == 0 && S_ISSOCK(st.st_mode))
     {
-      if(argv[*optind][sp+1] != '\0')
+      if((probeFd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
 	{
-	  *optarg = &argv[*optind][sp+1];
-	  *optind =  *optind + 1;
+	  printf("ERROR: Unable to create a socket: %s\n", strerror(errno));
+	  return FALSE;
 	}
-      else
+
+      if(connect(probeFd, (struct sockaddr *)&address, sizeof(address)) == 0)
 	{
-	  *optind =  *optind + 1;
-	  if(*optind >= argc)
-	    {
-	      printf(": option requires an argument -- %c\n", c);
-	      sp = 1;
-	      return('?');
-	    }
-	  else
-	    {
-	      *optarg = argv[*optind];
-	      *optind =  *optind + 1;
-	    }
+	  close(probeFd);
+	  printf("ERROR: A server is already listening on socket %s\n", socketFileName);
+	  return FALSE;
 	}
-      sp = 1;
+
+      if(errno == ECONNREFUSED)
+	unlink(socketFileName);
+
+      close(probeFd);
     }
-  else
+
+  q.capacity    = SERVER_QUEUE_PER_THREAD * tr->threads;
+  q.head        = 0;
+  q.count       = 0;
+  q.flags       = tr->countOnly ? TREE_COUNTER_COUNT_ONLY : 0;
+  q.connections = (int *)malloc(sizeof(int) * q.capacity);
+
+  listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if(listenFd < 0 || bind(listenFd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listenFd, q.capacity) != 0)
     {
-      if(argv[*optind][++sp] == '\0')
-	{
-	  sp = 1;
-	  *optind =  *optind + 1;
-	}
-      *optarg = 0;
+      printf("ERROR: Unable to listen on socket %s: %s\n", socketFileName, strerror(errno));
+      return FALSE;
     }
-  return(c);
-  }
 
+  /* clients that close early must not terminate the server, SIGINT and SIGTERM interrupt accept() */
 
-static void printHelp(void)
-{
-  printf("\n\nThis is the tree counter program released in June 2011 by Alexandros Stamatakis\n");
-  printf("it can either compute the number of possible bifurcating trees for n taxa via the\n\n");
-  printf(" -n numberOfTaxa\n\n");
-  printf("option or .... \n\n");
-  printf("Compute the number of possible bifurcating trees for a multi-furcating \n");
-  printf("Newick constraint tree passed via the \n\n");
-  printf(" -t constraintTreeFileName\n\n");
-  printf("option. The constraint tree format must be RAxML readable\n");
-  printf("\n\n");
-}
-
-static void get_args(int argc, char *argv[], tree *tr)
-{
-  boolean
-    bad_opt    =FALSE;
+  signal(SIGPIPE, SIG_IGN);
 
-  char          
-    *optarg;
-    
-  int  
-    optind = 1,        
-    c;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stopServer;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, (struct sigaction *)NULL);
+  sigaction(SIGTERM, &action, (struct sigaction *)NULL);
 
-  boolean 
-    numSet = FALSE,
-    constraintSet = FALSE;
+  pthread_mutex_init(&(q.mutex), (pthread_mutexattr_t *)NULL);
+  pthread_cond_init(&(q.notEmpty), (pthread_condattr_t *)NULL);
+  pthread_cond_init(&(q.notFull), (pthread_condattr_t *)NULL);
 
-  tr->mxtips = 0;
-  tr->ntips = 0;
-  tr->detectedTips = 0;
-  tr->rooted = FALSE;
-  tr->parseTree = FALSE;
-  tr->nextnode = 0;
-  
-  /*treeFileName = "";*/
- 
-  
-  /********* tr inits end*************/
+  workers = (serverWorker *)malloc(sizeof(serverWorker) * tr->threads);
+  assert(q.connections && workers);
 
+  /* the workers block SIGINT and SIGTERM, which thus always interrupt accept() in this thread */
 
-  while(!bad_opt &&
-	((c = mygetopt(argc,argv,"n:t:h", &optind, &optarg))!=-1))
-    {
-    switch(c)
-      {
-      case 'n':
-	sscanf(optarg,"%d", &(tr->mxtips));
-	if(tr->mxtips <= 2)
-	  {
-	    printf("A tree with less than 3 taxa?\n");	   
-	    exit(-1);
-	  }
-	numSet = TRUE;
-	break;      
-      case 't':
-	tr->parseTree = TRUE;
-	strcpy(treeFileName, optarg);
-	constraintSet = TRUE;
-	break;           
-      case 'h':
-	printHelp();
-	exit(0);
-	break;
-      default:
-	printf("Option %c not supported\n", c);
-    }
-  }
+  sigemptyset(&stopSignals);
+  sigaddset(&stopSignals, SIGINT);
+  sigaddset(&stopSignals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &stopSignals, &previous);
 
- 
-  if((numSet && constraintSet) || (!(numSet || constraintSet)))
+  for(i = 0; i < tr->threads; i++)
     {
-      printf("Usage error you need to either specify a constraint via -t\n");
-      printf("or the number of taxa via -n \n");
-      exit(-1);
-    }
+      workers[i].queue = &q;
 
-  return;
-}
+      if(pthread_create(&thread, (pthread_attr_t *)NULL, serverWorkerThread, (void *)&workers[i]) != 0)
+	{
+	  printf("ERROR: Unable to start server thread %d of %d\n", i + 1, tr->threads);
+	  close(listenFd);
+	  unlink(socketFileName);
+	  return FALSE;
+	}
 
+      pthread_detach(thread);
+    }
 
-static void computeNumberOfTrees(tree *tr)
-{
-   mpz_t 
-      integ,
-      treeNum;  
-   
-   int 
-     n,
-     i;
-   
-   char 
-     *b = (char*)NULL,
-     *c = (char*)NULL;
-    
-   mpz_init(integ);
-   mpz_init(treeNum);
+  pthread_sigmask(SIG_SETMASK, &previous, (sigset_t *)NULL);
 
-   mpz_set_ui(integ, 1);
+  printf("Listening on socket %s with %d threads\n", socketFileName, tr->threads);
+  fflush(stdout);
 
-   for(i = 3; i <= tr->mxtips; i++)
-     {
-       mpz_set_ui(treeNum, (unsigned long int)(2 * i - 5));
-       mpz_mul(integ, integ, treeNum);
-     }
-   
-   b = mpz_get_str (b, 10, integ);
-	       
-   printf("Number of unrooted binary trees for %d taxa: %s\n\n", tr->mxtips, b);  
+  idle.tv_sec  = SERVER_IDLE_SECONDS;
+  idle.tv_usec = 0;
 
-   n = strlen(b);
+  while(!serverStop)
+    {
+      if((fd = accept(listenFd, (struct sockaddr *)NULL, (socklen_t *)NULL)) < 0)
+	{
+	  if(errno == EINTR || errno == ECONNABORTED)
+	    continue;
 
-   if(n > 3)            
-     printf("Approximately %c.%c%c times 10^%d\n\n\n", b[0], b[1], b[2], n - 1);   
+	  printf("ERROR: Unable to accept connections on socket %s: %s\n", socketFileName, strerror(errno));
+	  break;
+	}
 
-   free(b);           
+      (void) setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+      (void) setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &idle, sizeof(idle));
 
-   
-   mpz_set_ui(treeNum, (unsigned long int)(2 * (tr->mxtips + 1) - 5));
-   mpz_mul(integ, integ, treeNum);
+      pthread_mutex_lock(&(q.mutex));
+      while(q.count == q.capacity && !serverStop)
+	{
+	  clock_gettime(CLOCK_REALTIME, &deadline);
+	  deadline.tv_sec += SERVER_POLL_SECONDS;
+	  pthread_cond_timedwait(&(q.notFull), &(q.mutex), &deadline);
+	}
 
-   c = mpz_get_str (c, 10, integ);
-	       
-   printf("Number of rooted binary trees for %d taxa: %s\n\n", tr->mxtips, c); 
+      if(serverStop)
+	{
+	  pthread_mutex_unlock(&(q.mutex));
+	  close(fd);
+	  break;
+	}
 
-   n = strlen(c);
+      q.connections[(q.head + q.count) % q.capacity] = fd;
+      q.count++;
+      pthread_cond_signal(&(q.notEmpty));
+      pthread_mutex_unlock(&(q.mutex));
+    }
 
-   if(n > 3)            
-     printf("Approximately %c.%c%c times 10^%d\n\n\n", c[0], c[1], c[2], n - 1);  
+  close(listenFd);
+  unlink(socketFileName);
 
-   free(c);   
+  printf("Server on socket %s stopped\n", socketFileName);
 
+  return (serverStop != 0);
 }
 
 
@@ -1004,85 +6836,66 @@ int main (int argc, char *argv[])
 
   get_args(argc,argv, tr); 
 
-  printf("\n\nGNU GPL tree number calculator released June 2011 by Alexandros Stamatakis\n\n");
-
- 
-  
+  /* with raw and json output the counts are the only output on standard output */
 
-  if(tr->parseTree)
+  if(tr->format == FORMAT_RAW || tr->format == FORMAT_JSON)
     {
-      nodeptr 
-	p0,
-	p,
-	q;
-      
-      int
-	j,
-	i,
-	tips,
-	inter;
-
-      FILE *f = fopen(treeFileName, "rb");
+      fflush(stdout);
+      countFile = fdopen(dup(1), "w");
+      dup2(2, 1);
+    }
+  else
+    countFile = stdout;
 
-      extractTaxaFromTopology(tr, treeFileName);
-      
-      tr->mxtips = tr->detectedTips;
-      
-      tips  = tr->mxtips;
-      inter = tr->mxtips - 1;
- 
-      if (!(p0 = (nodeptr) malloc((tips + 3 * inter) * sizeof(node))))
-	{
-	  printf("ERROR: Unable to obtain sufficient tree memory\n");
-	  return 0;
-	}
+  setvbuf(countFile, (char *)NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
 
-      if (!(tr->nodep = (nodeptr *) malloc((2 * tr->mxtips) * sizeof(nodeptr))))
-	{
-	  printf("ERROR: Unable to obtain sufficient tree memory, too\n");
-	  return  0;
-	}
+  printf("\n\nGNU GPL tree number calculator released June 2011 by Alexandros Stamatakis\n\n");
 
-      tr->nodep[0] = (node *) NULL;
+  if(tr->cacheTaxa > 0 && !writeDoubleFactorialCache(cacheFileName, (unsigned long int)tr->cacheTaxa, tr->threads))
+    {
+      printf("ERROR: Unable to write double factorial cache %s\n", cacheFileName);
+      return -1;
+    }
 
-      for (i = 1; i <= tips; i++)
-	{
-	  p = p0++;     
-	  p->x      =  0;
-	  p->number =  i;
-	  p->next   =  p;
-	  p->back   = (node *)NULL;	  
-	  tr->nodep[i] = p;
-	}
+  if(tr->useCache && !openDoubleFactorialCache(cacheFileName))
+    printf("Double factorial cache %s is not usable, computing without it\n\n", cacheFileName);
 
-      for (i = tips + 1; i <= tips + inter; i++)
-	{
-	  q = (node *) NULL;
-	  for (j = 1; j <= 3; j++)
-	    {	 
-	      p = p0++;
-	      if(j == 1)
-		p->x = 1;
-	      else
-		p->x =  0;
-	      p->number = i;
-	      p->next   = q;	  
-	      p->back   = (node *) NULL;	  
-	      q = p;
-	    }
-	  p->next->next->next = p;
-	  tr->nodep[i] = p;
-	}
+  if(resultCacheDir[0] != '\0' && mkdir(resultCacheDir, 0777) != 0 && errno != EEXIST)
+    {
+      printf("Result cache directory %s is not usable, computing without it\n\n", resultCacheDir);
+      resultCacheDir[0] = '\0';
+    }
 
-      tr->start       = (node *) NULL;
+  tr->rowFile = countFile;
 
-      treeReadLenMULT(f, tr);
+  if(tr->server)
+    {
+      if(!runServer(tr))
+	return -1;
+    }
+  else if(tr->parseTree)
+    {
+      boolean 
+	success;
 
-      fclose(f);
+      if(tr->multiFile)
+	success = countTreeFiles(tr);
+      else
+	success = countTreeFile(tr);
 	
+      if(!success)
+	return -1;
     }
-  else
+  else if(tr->rangeStride > 0)
+    tabulateNumberOfTrees(tr);
+  else if(tr->approximate && tr->numTaxa > 0)
+    approximateNumberOfTrees(tr);
+  else if(tr->mxtips > 0)
     computeNumberOfTrees(tr);
 
+  closeDoubleFactorialCache();
+
   return 0;
 }
+
+#endif
@@ -0,0 +1,79 @@
+/*
+   libtreecounter, the tree counter as a library.
+
+   A context holds the parser state, i.e., the taxon hash table, the
+   topology, the scratch buffers and the degree histogram, which are
+   reused by all calls with the same context. The calls are reentrant,
+   contexts may be used concurrently by different threads as long as
+   every context is only used by one thread at a time. Nothing is
+   printed, the calls return one of the status codes below and the
+   message of the last failed call is available via
+   treeCounterErrorMessage(). The counts are GMP integers, the library
+   is linked with -lgmp -lpthread -lm.
+*/
+
+#ifndef TREE_COUNTER_H
+#define TREE_COUNTER_H
+
+#include <stddef.h>
+#include <gmp.h>
+
+#define TREE_COUNTER_OK               0
+#define TREE_COUNTER_ARGUMENT_ERROR   1
+#define TREE_COUNTER_IO_ERROR         2
+#define TREE_COUNTER_SYNTAX_ERROR     3
+#define TREE_COUNTER_DUPLICATE_TAXON  4
+#define TREE_COUNTER_TOO_FEW_TAXA     5
+#define TREE_COUNTER_TOO_LARGE        6
+
+/* flags of treeCounterCreate() */
+
+#define TREE_COUNTER_COUNT_ONLY       1   /* count without building the tree, no duplicate taxa check */
+
+typedef struct treeCounterContext treeCounterContext;
+
+typedef struct
+{
+  long long  taxa;
+  int        maxMultifurcation;   /* -1 for the count of all trees for n taxa */
+  int        rooted;              /* the constraint tree is rooted, or the rooted count for n taxa */
+  mpz_t      count;
+}
+  treeCounterResult;
+
+/* threads are used for the big products, returns NULL for threads < 1 or without memory */
+
+treeCounterContext *treeCounterCreate(int threads, int flags);
+void treeCounterFree(treeCounterContext *c);
+
+void treeCounterInitResult(treeCounterResult *r);
+void treeCounterClearResult(treeCounterResult *r);
+
+/* the first Newick tree in length bytes at buffer, or read from fd which is not closed */
+
+int treeCounterCountBuffer(treeCounterContext *c, const char *buffer, size_t length, treeCounterResult *r);
+int treeCounterCountFd(treeCounterContext *c, int fd, treeCounterResult *r);
+
+/* all unrooted, or rooted, binary trees for taxa taxa */
+
+int treeCounterCountTaxa(treeCounterContext *c, long long taxa, int rooted, treeCounterResult *r);
+
+/* 
+   a double factorial cache file written by treeCounter -C file -B n, not 
+   thread-safe, open it before and close it after all counting calls 
+*/
+
+int treeCounterOpenCache(const char *fileName);
+void treeCounterCloseCache(void);
+
+/* 
+   a directory, created if needed, for the persistent cache of constraint 
+   counts, NULL disables it, set it before all counting calls 
+*/
+
+int treeCounterSetResultCache(const char *directory);
+
+const char *treeCounterErrorMessage(treeCounterContext *c);
+const char *treeCounterStatusString(int status);
+
+#endif